@@ -7,6 +7,7 @@
 #include <cstdlib>
 #include <utility>
 #include <atomic>
+#include <new>
 #include "logger.hpp"
 
 #ifdef _WIN32
@@ -21,8 +22,10 @@ const int32_t MAX_IPV4 = 16;
 const int32_t MAX_IPV6 = 40;
 const int32_t MAX_IP = MAX_IPV6;
 
+//墙上时间，由AsyncFrame::start()定时刷新，仅用于日志和展示
+//定时器使用各线程的单调时钟BaseThread::now_us()，见clock.hpp
 extern volatile time_t g_unix_timestamp; //unit:s
-extern volatile uint64_t g_us_tick; //unit:us , precision:ms
+extern volatile uint64_t g_us_tick; //unit:us , precision:10ms
 
 #ifdef _ASYNCPP_DEBUG
 #define _TRACELOG(logger, fmt, ...) logger_trace(logger, fmt , ##__VA_ARGS__)
@@ -79,6 +82,7 @@ enum class MsgBufferType : uint8_t
 	STATIC, //销毁时无需执行任何操作
 	MALLOC, //销毁时使用free
 	NEW, //销毁时使用delete[]
+	SHARED, //由alloc_shared_buffer分配，销毁时减少引用计数，减到0时释放
 };
 
 class MsgContext
@@ -106,6 +110,38 @@ inline void free_context(MsgCtx& ctx, MsgContextType ctx_type)
 	}
 }
 
+//SHARED缓冲区的头部，紧挨在数据之前，保持数据16字节对齐
+struct alignas(16) SharedBufferHead
+{
+	std::atomic<uint32_t> m_ref;
+};
+
+/*
+ 分配可被多个消息共享的缓冲区，初始引用计数为1
+ 每次以MsgBufferType::SHARED入队或发送前调用ref_shared_buffer增加引用，
+ free_buffer(buf, MsgBufferType::SHARED)减少引用
+ @return 数据地址，失败返回nullptr
+*/
+inline char* alloc_shared_buffer(uint32_t len)
+{
+	void* p = malloc(sizeof(SharedBufferHead) + len);
+	if (p == nullptr) return nullptr;
+	auto head = new (p) SharedBufferHead;
+	head->m_ref.store(1, std::memory_order_relaxed);
+	return reinterpret_cast<char*>(head + 1);
+}
+
+inline SharedBufferHead* shared_buffer_head(char* buf)
+{
+	return reinterpret_cast<SharedBufferHead*>(buf) - 1;
+}
+
+inline char* ref_shared_buffer(char* buf, uint32_t n = 1)
+{
+	shared_buffer_head(buf)->m_ref.fetch_add(n, std::memory_order_relaxed);
+	return buf;
+}
+
 inline void free_buffer(char*& buf, MsgBufferType buf_type)
 {
 	switch (buf_type)
@@ -113,6 +149,14 @@ inline void free_buffer(char*& buf, MsgBufferType buf_type)
 	case MsgBufferType::STATIC: break;
 	case MsgBufferType::MALLOC: free(buf); buf = nullptr;  break;
 	case MsgBufferType::NEW: delete[] buf; buf = nullptr; break;
+	case MsgBufferType::SHARED:
+		if (shared_buffer_head(buf)->m_ref.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			shared_buffer_head(buf)->~SharedBufferHead();
+			free(shared_buffer_head(buf));
+		}
+		buf = nullptr;
+		break;
 	default: break;
 	}
 }
@@ -57,6 +57,7 @@ AsyncFrame::~AsyncFrame()
 static void thread_main(BaseThread* t)
 {
 	_WARNLOG(logger, "%s", typeid(*t).name());
+	BaseThread::set_current(t);
 	t->set_state(ThreadState::WORKING);
 	t->on_start();
 	t->run();
@@ -96,19 +97,11 @@ void AsyncFrame::start()
 		}
 	}
 
+	//墙上时间只用于日志和展示，定时器使用各线程自己的单调时钟
 	while (!end())
 	{
-#ifdef _WIN32
-		FILETIME ft;
-		GetSystemTimeAsFileTime(&ft);
-		g_us_tick = ((uint64_t)ft.dwHighDateTime << 32 | ft.dwLowDateTime) / 10;
+		g_us_tick = wall_clock_us();
 		g_unix_timestamp = time(NULL);
-#else
-		struct timeval tv;
-		gettimeofday(&tv, NULL);
-		g_us_tick = (uint64_t)tv.tv_sec*1000*1000 + tv.tv_usec;
-		g_unix_timestamp = tv.tv_sec;
-#endif
 		///TODO:: server manager
 		usleep(10 * 1000);
 	}
@@ -132,6 +125,10 @@ void AsyncFrame::start()
 void AsyncFrame::stop()
 {
 	m_end = true;
+	for (auto t_pool : m_thread_pools)
+	{
+		t_pool->wakeup_all();
+	}
 }
 
 } //end of namespace asyncpp
@@ -71,16 +71,38 @@ public:
 			global_net_thread_id, 0, global_net_thread_id, sender, seq);
 	}
 
+	/**
+	向全局线程global_net_thread_id绑定一个UDP端口
+	该端口上收到的每个数据报都由该线程回调一次process_net_msg，conn->m_peer_addr为来源地址
+	@return true表示请求发送成功
+	*/
+	bool add_udp_listener(thread_id_t global_net_thread_id,
+		const char* ip, uint16_t port,
+		BaseThread* sender = nullptr, int32_t seq = 0)
+	{
+		return add_listener(ip, port, global_net_thread_id, 0,
+			global_net_thread_id, sender, seq, SOCK_DGRAM);
+	}
+
 	/**
 	向全局线程global_net_thread_id添加一个监听端口
 	连接上来的client将交由client_thread_pool_id线程组的client_thread_id线程处理
 	client_thread_id=INVALID_THREAD_ID表示自动选择client_thread_pool_id中的某个线程处理
+	ip为"unix:/path"或"unix:@name"(抽象命名空间，仅Linux)时监听Unix域socket，忽略port
+	sock_type=SOCK_DGRAM表示绑定UDP端口，见add_udp_listener
+	backlog为listen的队列长度；defer_accept不为0时设置TCP_DEFER_ACCEPT，
+	客户端发来数据或超过defer_accept秒后才accept，仅Linux
+	client_thread_id=INVALID_THREAD_ID时按placement选择处理线程，见ClientPlacement
+	指定了处理线程时，一次accept到的多个连接按线程合并为一个消息转交
 	@return true表示请求发送成功
 	*/
 	bool add_listener(const char* ip, uint16_t port,
 		thread_id_t global_net_thread_id,
 		thread_pool_id_t client_thread_pool_id, thread_id_t client_thread_id,
-		BaseThread* sender = nullptr, int32_t seq = 0)
+		BaseThread* sender = nullptr, int32_t seq = 0,
+		int32_t sock_type = SOCK_STREAM,
+		int32_t backlog = _ASYNCPP_LISTEN_BACKLOG, uint32_t defer_accept = 0,
+		ClientPlacement placement = ClientPlacement::ANY)
 	{
 		ThreadMsg msg;
 		auto ctx = new AddListenerCtx;
@@ -100,12 +122,76 @@ public:
 		ctx->m_client_thread_pool_id = client_thread_pool_id;
 		ctx->m_client_thread_id = client_thread_id;
 		ctx->m_seq = seq;
+		ctx->m_sock_type = sock_type;
+		ctx->m_backlog = backlog;
+		ctx->m_defer_accept = defer_accept;
+		ctx->m_placement = placement;
 		msg.m_ctx.obj = ctx;
 		msg.m_ctx_type = MsgContextType::OBJECT;
 
 		return send_thread_msg(std::move(msg));
 	}
 
+	/**
+	向全局线程global_net_thread_id添加一个监听端口
+	连接上来的client由监听线程按placement在client_thread_pool_id线程组中选定一个线程，
+	直接发到该线程的消息队列
+	LEAST_CONN/LEAST_BYTES依据各线程在每次poll后更新的负载，线程组须为MultiplexNetThread
+	@return true表示请求发送成功
+	*/
+	bool add_listener(const char* ip, uint16_t port,
+		thread_id_t global_net_thread_id,
+		thread_pool_id_t client_thread_pool_id, ClientPlacement placement,
+		BaseThread* sender = nullptr, int32_t seq = 0)
+	{
+		return add_listener(ip, port, global_net_thread_id,
+			client_thread_pool_id, INVALID_THREAD_ID, sender, seq,
+			SOCK_STREAM, _ASYNCPP_LISTEN_BACKLOG, 0, placement);
+	}
+
+	/**
+	net_thread_pool_id线程组的每个线程各自监听ip:port(SO_REUSEPORT)，并直接accept和处理自己的连接
+	不需要监听线程，连接也不经过消息队列转交，由内核在各线程的监听socket间分配
+	mode=ReusePortMode::CPU时CPU k上收到的连接交给组内第k个线程(模线程数)，线程k应绑定到CPU k
+	各线程按顺序依次监听，全部成功或某个线程出错后向sender回复一个NET_LISTEN_ADDR_RESP，
+	成功时m_connid为最后一个监听的fd；出错时按相反顺序关闭已建立的监听后再回复
+	线程组内须全部为MultiplexNetThread
+	backlog和defer_accept同add_listener，作用于每个线程的监听socket
+	@return true表示请求发送成功
+	*/
+	bool add_reuseport_listener(const char* ip, uint16_t port,
+		thread_pool_id_t net_thread_pool_id,
+		ReusePortMode mode = ReusePortMode::HASH,
+		BaseThread* sender = nullptr, int32_t seq = 0,
+		int32_t backlog = _ASYNCPP_LISTEN_BACKLOG, uint32_t defer_accept = 0)
+	{
+		ThreadMsg msg;
+		auto ctx = new AddListenerCtx;
+		msg.m_type = NET_LISTEN_ADDR_REQ;
+		if (sender != nullptr)
+		{
+			msg.m_src_thread_id = sender->get_id();
+			msg.m_src_thread_pool_id = sender->get_thread_pool_id();
+		}
+		msg.m_dst_thread_id = 0;
+		msg.m_dst_thread_pool_id = net_thread_pool_id;
+		msg.m_buf_len = static_cast<uint32_t>(strlen(ip));
+		msg.m_buf = new char[msg.m_buf_len + 1];
+		memcpy(msg.m_buf, ip, msg.m_buf_len + 1);
+		msg.m_buf_type = MsgBufferType::NEW;
+		ctx->m_port = port;
+		ctx->m_client_thread_pool_id = net_thread_pool_id;
+		ctx->m_client_thread_id = 0;
+		ctx->m_seq = seq;
+		ctx->m_reuseport = mode != ReusePortMode::NONE ? mode : ReusePortMode::HASH;
+		ctx->m_backlog = backlog;
+		ctx->m_defer_accept = defer_accept;
+		msg.m_ctx.obj = ctx;
+		msg.m_ctx_type = MsgContextType::OBJECT;
+
+		return send_thread_msg(std::move(msg), true);
+	}
+
 	/*********************添加连接*********************/
 	/**
 	添加一个全局网络线程用于连接服务器
@@ -121,16 +207,30 @@ public:
 		return id;
 	}
 	
+	/**
+	向net_thread_pool_id线程组的net_thread_id线程添加一个UDP连接(connect到host:port的UDP socket)
+	参数和结果同add_connector，send发出的每条消息是一个数据报
+	*/
+	bool add_udp_connector(const char* host, uint16_t port,
+		thread_pool_id_t net_thread_pool_id, thread_id_t net_thread_id,
+		BaseThread* sender = nullptr, int32_t seq = 0)
+	{
+		return add_connector(host, port, net_thread_pool_id, net_thread_id,
+			sender, seq, SOCK_DGRAM);
+	}
+
 	/**
 	向net_thread_pool_id线程组的net_thread_id线程添加一个网络连接
 	net_thread_pool_id=0表示向global_net_thread_id添加一个网络连接
 	net_thread_id=INVALID_THREAD_ID表示自动选择
+	host为"unix:/path"或"unix:@name"时连接Unix域socket，忽略port
 	@return true表示请求发送成功
 	        失败原因：xxx_id不合法，目标线程消息队列满
 	*/
 	bool add_connector(const char* host, uint16_t port,
 		thread_pool_id_t net_thread_pool_id, thread_id_t net_thread_id,
-		BaseThread* sender = nullptr, int32_t seq = 0)
+		BaseThread* sender = nullptr, int32_t seq = 0,
+		int32_t sock_type = SOCK_STREAM)
 	{
 		ThreadMsg msg;
 		auto ctx = new AddConnectorCtx;
@@ -148,6 +248,7 @@ public:
 		msg.m_buf_type = MsgBufferType::NEW;
 		ctx->m_seq = seq;
 		ctx->m_port = port;
+		ctx->m_sock_type = sock_type;
 		msg.m_ctx.obj = ctx;
 		msg.m_ctx_type = MsgContextType::OBJECT;
 		
@@ -157,29 +258,48 @@ public:
 	/************************添加线程组************************/
 	/**
 	创建一个线程组，初始有thread_num个Thread线程
+	@param pool_queue_size 线程组消息队列容量
+	@param thread_queue_size 组内每个线程的消息队列容量
+	@param overflow 为true时队列满后的消息存入溢出段，不会因队列满而发送失败
+	@param work_stealing 为true时开启工作窃取模式，见ThreadPool::set_work_stealing
 	@return t_pool_id
 	*/
 	template<typename Thread>
-	thread_pool_id_t add_thread_pool(uint8_t thread_num)
+	thread_pool_id_t add_thread_pool(uint8_t thread_num,
+		uint32_t pool_queue_size = _ASYNCPP_THREAD_POOL_QUEUE_SIZE - 1,
+		uint32_t thread_queue_size = _ASYNCPP_THREAD_QUEUE_SIZE,
+		bool overflow = false, bool work_stealing = false)
 	{
 		thread_pool_id_t id = m_thread_pools.size();
 		ThreadPool* t_pool = new ThreadPool(this, id);
 		m_thread_pools.push_back(t_pool);
+		t_pool->set_work_stealing(work_stealing);
+		if (pool_queue_size != _ASYNCPP_THREAD_POOL_QUEUE_SIZE - 1 || overflow)
+		{
+			t_pool->set_msg_queue_size(pool_queue_size, overflow);
+		}
 		for (uint32_t i = 0; i < thread_num; ++i)
 		{
-			t_pool->add_thread(new Thread());
+			add_thread<Thread>(id, thread_queue_size, overflow);
 		}
 		return id;
 	}
 
 	/**
 	向thread_pool_id线程组中添加一个Thread线程
+	@param queue_size 线程消息队列容量
+	@param overflow 为true时队列满后的消息存入溢出段
 	@return t_id
 	*/
 	template<typename Thread>
-	thread_id_t add_thread(thread_pool_id_t t_pool_id)
+	thread_id_t add_thread(thread_pool_id_t t_pool_id,
+		uint32_t queue_size = _ASYNCPP_THREAD_QUEUE_SIZE, bool overflow = false)
 	{
 		BaseThread* new_thread = new Thread();
+		if (queue_size != new_thread->get_msg_queue_capacity() || overflow)
+		{
+			new_thread->set_msg_queue_size(queue_size, overflow);
+		}
 		return add_thread(t_pool_id, new_thread);
 	}
 
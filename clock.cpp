@@ -0,0 +1,132 @@
+﻿#include "clock.hpp"
+#include <ctime>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+#if defined(_ASYNCPP_CLOCK_TSC) && defined(__x86_64__) && defined(__GNUC__)
+#include <x86intrin.h>
+#include <cpuid.h>
+#define _ASYNCPP_CLOCK_USE_TSC
+#endif
+
+namespace asyncpp
+{
+
+static uint64_t clock_gettime_ns()
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq = {};
+	LARGE_INTEGER cnt;
+	if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&cnt);
+	return static_cast<uint64_t>(cnt.QuadPart / freq.QuadPart * 1000000000
+		+ cnt.QuadPart % freq.QuadPart * 1000000000 / freq.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+#ifdef _ASYNCPP_CLOCK_USE_TSC
+/*
+ TSC频率校准，ns = (tsc差值 * mult) >> 32
+ 首次使用时通过间隔约10ms的两次采样计算
+*/
+struct TscCalibration
+{
+	uint64_t mult;
+	uint64_t resync_ticks; //约1s对应的TSC差值
+	bool enabled;
+
+	TscCalibration() : mult(0), resync_ticks(0), enabled(false)
+	{
+		unsigned int eax, ebx, ecx, edx;
+		//CPUID.80000007H:EDX[8] invariant TSC
+		if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0
+			|| (edx & (1u << 8)) == 0) return;
+
+		uint64_t ns0 = clock_gettime_ns();
+		uint64_t tsc0 = __rdtsc();
+		struct timespec ts = { 0, 10 * 1000 * 1000 };
+		nanosleep(&ts, nullptr);
+		uint64_t ns1 = clock_gettime_ns();
+		uint64_t tsc1 = __rdtsc();
+		if (tsc1 <= tsc0 || ns1 <= ns0) return;
+
+		mult = ((ns1 - ns0) << 32) / (tsc1 - tsc0);
+		if (mult == 0) return;
+		resync_ticks = (1000000000ull << 32) / mult;
+		enabled = true;
+	}
+};
+
+static const TscCalibration& tsc_calibration()
+{
+	static TscCalibration calibration;
+	return calibration;
+}
+
+/*
+ 每个线程各自的锚点，每隔约1s用clock_gettime重新对齐，校准误差不会累积
+ 重新对齐时保证返回值不回退
+*/
+struct TscAnchor
+{
+	uint64_t tsc;
+	uint64_t ns;
+	uint64_t last_us;
+};
+static thread_local TscAnchor s_tsc_anchor = { 0, 0, 0 };
+
+static uint64_t tsc_now_us(const TscCalibration& cal)
+{
+	TscAnchor& anchor = s_tsc_anchor;
+	uint64_t tsc = __rdtsc();
+	if (anchor.tsc == 0 || tsc - anchor.tsc > cal.resync_ticks)
+	{
+		anchor.ns = clock_gettime_ns();
+		anchor.tsc = tsc = __rdtsc();
+	}
+	unsigned __int128 d = tsc - anchor.tsc;
+	uint64_t us = (anchor.ns + static_cast<uint64_t>((d * cal.mult) >> 32)) / 1000;
+	if (us < anchor.last_us) us = anchor.last_us;
+	anchor.last_us = us;
+	return us;
+}
+#endif
+
+uint64_t monotonic_us()
+{
+#ifdef _ASYNCPP_CLOCK_USE_TSC
+	const TscCalibration& cal = tsc_calibration();
+	if (cal.enabled) return tsc_now_us(cal);
+#endif
+	return clock_gettime_ns() / 1000;
+}
+
+uint64_t wall_clock_us()
+{
+#ifdef _WIN32
+	FILETIME ft;
+	GetSystemTimeAsFileTime(&ft);
+	return ((uint64_t)ft.dwHighDateTime << 32 | ft.dwLowDateTime) / 10;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000 * 1000 + tv.tv_usec;
+#endif
+}
+
+bool clock_tsc_enabled()
+{
+#ifdef _ASYNCPP_CLOCK_USE_TSC
+	return tsc_calibration().enabled;
+#else
+	return false;
+#endif
+}
+
+} //end of namespace asyncpp
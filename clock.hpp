@@ -0,0 +1,31 @@
+﻿#ifndef _CLOCK_HPP_
+#define _CLOCK_HPP_
+
+#include <cstdint>
+
+namespace asyncpp
+{
+
+/*
+ 单调时钟，不受系统时间调整影响，供定时器使用
+ 默认读取CLOCK_MONOTONIC(Windows下为QueryPerformanceCounter)
+ 定义_ASYNCPP_CLOCK_TSC后，在支持恒定频率TSC的x86-64 CPU上改用rdtsc，
+ 首次调用时以CLOCK_MONOTONIC校准频率；CPU不支持时自动退回clock_gettime
+ @return us，起点不确定，只能用于计算时间差
+*/
+uint64_t monotonic_us();
+
+/*
+ 墙上时间，可能因系统时间调整而跳变，仅用于日志等展示
+ @return us，Linux下从1970年起算，Windows下与FILETIME一致从1601年起算
+*/
+uint64_t wall_clock_us();
+
+/*
+ monotonic_us()是否正在使用TSC
+*/
+bool clock_tsc_enabled();
+
+} //end of namespace asyncpp
+
+#endif
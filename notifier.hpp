@@ -0,0 +1,189 @@
+﻿#ifndef _NOTIFIER_HPP_
+#define _NOTIFIER_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <cerrno>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <poll.h>
+#include <ctime>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/futex.h>
+#else
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#endif
+
+namespace asyncpp
+{
+
+/*
+ 线程唤醒器，用于替代空闲时的定时usleep
+ 消费者线程: prepare_park() -> 再次检查是否有任务 -> park()或cancel_park()
+ 生产者线程: 投递任务后调用notify()，仅当消费者确实已挂起时才会产生系统调用
+ Linux下默认使用futex挂起；enable_fd()后改用eventfd，
+ 此时可将fd()注册进selector，由selector负责等待，唤醒后调用drain()
+*/
+class ThreadNotifier
+{
+public:
+	enum : uint32_t
+	{
+		RUNNING,
+		PARKED,
+		NOTIFIED,
+	};
+private:
+	std::atomic<uint32_t> m_state;
+#ifdef __linux__
+	int m_fd;
+#else
+	std::mutex m_mtx;
+	std::condition_variable m_cv;
+#endif
+public:
+	ThreadNotifier()
+		: m_state(RUNNING)
+#ifdef __linux__
+		, m_fd(-1)
+#endif
+	{
+	}
+	~ThreadNotifier()
+	{
+#ifdef __linux__
+		if (m_fd >= 0) ::close(m_fd);
+#endif
+	}
+	ThreadNotifier(const ThreadNotifier&) = delete;
+	ThreadNotifier& operator=(const ThreadNotifier&) = delete;
+
+public:
+	/*
+	 改用eventfd唤醒
+	 @return 0 on success
+	*/
+	int32_t enable_fd()
+	{
+#ifdef __linux__
+		if (m_fd < 0) m_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		return m_fd >= 0 ? 0 : errno;
+#else
+		return ENOTSUP;
+#endif
+	}
+	void disable_fd()
+	{
+#ifdef __linux__
+		if (m_fd >= 0) ::close(m_fd);
+		m_fd = -1;
+#endif
+	}
+	int fd() const
+	{
+#ifdef __linux__
+		return m_fd;
+#else
+		return -1;
+#endif
+	}
+
+	bool parked() const { return m_state.load(std::memory_order_relaxed) == PARKED; }
+
+	/*
+	 宣告即将挂起，调用后必须再次检查任务队列
+	*/
+	void prepare_park()
+	{
+		m_state.store(PARKED, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+	void cancel_park()
+	{
+		m_state.store(RUNNING, std::memory_order_relaxed);
+	}
+
+	/*
+	 挂起直到被notify()或超时
+	 @param timeout_us <0表示一直等待
+	*/
+	void park(int64_t timeout_us)
+	{
+#ifdef __linux__
+		if (m_fd >= 0)
+		{
+			struct pollfd pfd = { m_fd, POLLIN, 0 };
+			int ms = timeout_us < 0 ? -1 : static_cast<int>((timeout_us + 999) / 1000);
+			if (m_state.load(std::memory_order_acquire) == PARKED) ::poll(&pfd, 1, ms);
+			drain();
+		}
+		else if (m_state.load(std::memory_order_acquire) == PARKED)
+		{
+			struct timespec ts = { static_cast<time_t>(timeout_us / 1000000),
+				static_cast<long>(timeout_us % 1000000 * 1000) };
+			syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_state),
+				FUTEX_WAIT_PRIVATE, PARKED, timeout_us < 0 ? nullptr : &ts,
+				nullptr, 0);
+		}
+#else
+		std::unique_lock<std::mutex> lock(m_mtx);
+		if (timeout_us < 0)
+		{
+			m_cv.wait(lock, [this]{ return m_state.load() != PARKED; });
+		}
+		else
+		{
+			m_cv.wait_for(lock, std::chrono::microseconds(timeout_us),
+				[this]{ return m_state.load() != PARKED; });
+		}
+#endif
+		cancel_park();
+	}
+
+	/*
+	 清空eventfd计数
+	*/
+	void drain()
+	{
+#ifdef __linux__
+		uint64_t cnt;
+		if (m_fd >= 0) while (::read(m_fd, &cnt, sizeof cnt) > 0);
+#endif
+	}
+
+	/*
+	 唤醒挂起中的线程
+	 @return true表示本次调用唤醒了线程
+	*/
+	bool notify()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (m_state.load(std::memory_order_relaxed) != PARKED) return false;
+		if (m_state.exchange(NOTIFIED) != PARKED) return false;
+#ifdef __linux__
+		if (m_fd >= 0)
+		{
+			uint64_t one = 1;
+			ssize_t ret = ::write(m_fd, &one, sizeof one);
+			(void)ret;
+		}
+		else
+		{
+			syscall(SYS_futex, reinterpret_cast<uint32_t*>(&m_state),
+				FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+		}
+#else
+		std::lock_guard<std::mutex> lock(m_mtx);
+		m_cv.notify_one();
+#endif
+		return true;
+	}
+};
+
+} //end of namespace asyncpp
+
+#endif
@@ -0,0 +1,190 @@
+#ifndef _RINGQUEUE_HPP_
+#define _RINGQUEUE_HPP_
+
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <type_traits>
+
+#ifndef _ASYNCPP_RING_POOL_SIZE
+#define _ASYNCPP_RING_POOL_SIZE 64 //每个线程每种容量最多缓存的环数
+#endif
+
+namespace asyncpp
+{
+
+/*
+ 先进先出的环形队列，前N个元素存放在对象内部，不分配内存
+ 超出N时转移到堆上的环，容量按2倍增长；队列变空后归还堆上的环，回到内部存储
+ 堆上的环按容量缓存在线程本地的池中
+ 只用于可平凡复制的类型，元素按字节移动
+*/
+template <typename T, uint32_t N = 4>
+class ringqueue
+{
+	static_assert((N & (N - 1)) == 0 && N != 0, "N must be power of 2");
+	static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+
+private:
+	T m_inline[N];
+	T* m_heap; //nullptr表示使用m_inline
+	uint32_t m_cap;
+	uint32_t m_head;
+	uint32_t m_size;
+
+	//按容量(2的幂)分级缓存的堆上的环，线程退出时释放
+	struct Pool
+	{
+		std::vector<T*> free_list[32];
+		~Pool()
+		{
+			for (auto& l : free_list)
+			{
+				for (T* p : l) ::free(p);
+			}
+		}
+	};
+	static std::vector<T*>& pool(uint32_t cap)
+	{
+		static thread_local Pool s_pool;
+		uint32_t cls = 0;
+		while ((1u << cls) < cap) ++cls;
+		return s_pool.free_list[cls];
+	}
+	static T* alloc_ring(uint32_t cap)
+	{
+		auto& l = pool(cap);
+		if (!l.empty())
+		{
+			T* p = l.back();
+			l.pop_back();
+			return p;
+		}
+		return static_cast<T*>(::malloc(sizeof(T) * cap));
+	}
+	static void free_ring(T* p, uint32_t cap)
+	{
+		auto& l = pool(cap);
+		if (l.size() < _ASYNCPP_RING_POOL_SIZE) l.push_back(p);
+		else ::free(p);
+	}
+
+	T* buf() { return m_heap != nullptr ? m_heap : m_inline; }
+	const T* buf() const { return m_heap != nullptr ? m_heap : m_inline; }
+
+	void grow()
+	{
+		uint32_t cap = m_cap << 1;
+		T* p = alloc_ring(cap);
+		assert(p != nullptr);
+		//按顺序搬到新环的开头
+		const T* old = buf();
+		uint32_t first = m_cap - m_head;
+		if (first > m_size) first = m_size;
+		memcpy(p, old + m_head, sizeof(T) * first);
+		memcpy(p + first, old, sizeof(T) * (m_size - first));
+		if (m_heap != nullptr) free_ring(m_heap, m_cap);
+		m_heap = p;
+		m_cap = cap;
+		m_head = 0;
+	}
+	void shrink()
+	{
+		free_ring(m_heap, m_cap);
+		m_heap = nullptr;
+		m_cap = N;
+		m_head = 0;
+	}
+
+public:
+	template <typename Q, typename V>
+	class iter
+	{
+	private:
+		Q* m_q;
+		uint32_t m_idx;
+	public:
+		iter(Q* q, uint32_t idx) : m_q(q), m_idx(idx) {}
+		V& operator*() const { return (*m_q)[m_idx]; }
+		V* operator->() const { return &(*m_q)[m_idx]; }
+		iter& operator++() { ++m_idx; return *this; }
+		bool operator==(const iter& rhs) const { return m_idx == rhs.m_idx; }
+		bool operator!=(const iter& rhs) const { return m_idx != rhs.m_idx; }
+	};
+	typedef iter<ringqueue, T> iterator;
+	typedef iter<const ringqueue, const T> const_iterator;
+
+	ringqueue() : m_heap(nullptr), m_cap(N), m_head(0), m_size(0) {}
+	~ringqueue()
+	{
+		if (m_heap != nullptr) free_ring(m_heap, m_cap);
+	}
+	ringqueue(const ringqueue&) = delete;
+	ringqueue& operator=(const ringqueue&) = delete;
+	ringqueue(ringqueue&& val)
+		: m_heap(nullptr), m_cap(N), m_head(0), m_size(0)
+	{
+		*this = std::move(val);
+	}
+	ringqueue& operator=(ringqueue&& val)
+	{
+		if (this == &val) return *this;
+		if (m_heap != nullptr) free_ring(m_heap, m_cap);
+		if (val.m_heap == nullptr) memcpy(m_inline, val.m_inline, sizeof m_inline);
+		m_heap = val.m_heap;
+		m_cap = val.m_cap;
+		m_head = val.m_head;
+		m_size = val.m_size;
+		val.m_heap = nullptr;
+		val.m_cap = N;
+		val.m_head = 0;
+		val.m_size = 0;
+		return *this;
+	}
+
+	bool empty() const { return m_size == 0; }
+	uint32_t size() const { return m_size; }
+	uint32_t capacity() const { return m_cap; }
+
+	T& operator[](uint32_t idx) { return buf()[(m_head + idx) & (m_cap - 1)]; }
+	const T& operator[](uint32_t idx) const { return buf()[(m_head + idx) & (m_cap - 1)]; }
+	T& front() { assert(m_size != 0); return buf()[m_head]; }
+	const T& front() const { assert(m_size != 0); return buf()[m_head]; }
+	T& back() { assert(m_size != 0); return (*this)[m_size - 1]; }
+	const T& back() const { assert(m_size != 0); return (*this)[m_size - 1]; }
+
+	iterator begin() { return iterator(this, 0); }
+	iterator end() { return iterator(this, m_size); }
+	const_iterator begin() const { return const_iterator(this, 0); }
+	const_iterator end() const { return const_iterator(this, m_size); }
+
+	void push_back(const T& val)
+	{
+		if (m_size == m_cap) grow();
+		buf()[(m_head + m_size) & (m_cap - 1)] = val;
+		++m_size;
+	}
+	void pop_front()
+	{
+		assert(m_size != 0);
+		m_head = (m_head + 1) & (m_cap - 1);
+		if (--m_size == 0)
+		{
+			if (m_heap != nullptr) shrink();
+			else m_head = 0;
+		}
+	}
+	//不释放元素引用的资源
+	void clear()
+	{
+		m_size = 0;
+		if (m_heap != nullptr) shrink();
+		else m_head = 0;
+	}
+};
+
+} //end of namespace asyncpp
+
+#endif
@@ -5,6 +5,17 @@
 
 #ifdef __GNUC__
 
+namespace asyncpp
+{
+
+static void drain_notify_fd(SOCKET_HANDLE fd)
+{
+	uint64_t cnt;
+	while (read(fd, &cnt, sizeof cnt) > 0);
+}
+
+} //end of namespace asyncpp
+
 #ifndef _DISABLE_EPOLL
 
 namespace asyncpp
@@ -18,32 +29,38 @@ int32_t EpollSelector::poll(void* p_thread, uint32_t mode, uint32_t ms)
 	uint32_t bytes_sent_total = 0;
 	uint32_t bytes_recv_total = 0;
 	auto t = reinterpret_cast<MultiplexNetThread<EpollSelector>*>(p_thread);
-	struct epoll_event evs[16];
-	ret = epoll_wait(m_fd, evs, 16, ms);
+	int32_t batch = static_cast<int32_t>(m_evs.size());
+	ret = epoll_wait(m_fd, m_evs.data(), batch, static_cast<int>(ms));
 	if(ret > 0)
 	{
 		uint32_t bytes_sent;
 		uint32_t bytes_recv;
 		int32_t rp = rand() % ret;
 
-		for(int32_t i = rp; i<ret; ++i)
+		for(int32_t k = 0; k<ret; ++k)
 		{
-			NetConnect* conn = t->get_conn(static_cast<uint32_t>(evs[i].data.fd));
+			int32_t i = rp + k < ret ? rp + k : rp + k - ret;
+			NetConnect* conn = static_cast<NetConnect*>(m_evs[i].data.ptr);
+			if(conn == nullptr)
+			{
+				drain_notify_fd(m_notify_fd);
+				continue;
+			}
 
-			if(mode&SELIN && evs[i].events&EPOLLIN)
+			if(mode&SELIN && m_evs[i].events&EPOLLIN)
 			{
 				bytes_recv = t->on_read_event(conn);
 				///TODO: 出错中断，防止重复on_error_event
 			}
 			else bytes_recv = 0;
 
-			if(mode&SELOUT && evs[i].events&EPOLLOUT)
+			if(mode&SELOUT && m_evs[i].events&EPOLLOUT)
 			{
 				bytes_sent = t->on_write_event(conn);
 			}
 			else bytes_sent = 0;
 
-			if(evs[i].events & EPOLLERR)
+			if(m_evs[i].events & EPOLLERR)
 			{
 				++bytes_recv;
 				t->on_error_event(conn);
@@ -54,24 +71,738 @@ int32_t EpollSelector::poll(void* p_thread, uint32_t mode, uint32_t ms)
 			bytes_recv_total += bytes_recv;
 		}
 
-		for(int32_t i = 0; i<rp; ++i)
+		//取满则扩大下次的批量，不足1/4则缩小
+		if (ret == batch && batch < _ASYNCPP_EPOLL_MAX_EVENTS)
+		{
+			m_evs.resize(std::min(batch * 2, _ASYNCPP_EPOLL_MAX_EVENTS));
+		}
+		else if (ret <= batch / 4 && batch > _ASYNCPP_EPOLL_MIN_EVENTS)
+		{
+			m_evs.resize(std::max(batch / 2, _ASYNCPP_EPOLL_MIN_EVENTS));
+		}
+	}
+	else if(ret < 0)
+	{
+		t->m_ss.sample(0, 0);
+		_WARNLOG(logger, "epoll_wait fail:%d[%s]", errno, strerror(errno));
+	}
+	else
+	{
+		t->m_ss.sample(0, 0);
+	}
+		
+	//t->m_ss.sample(bytes_recv_total, bytes_sent_total);
+	return bytes_sent_total + bytes_recv_total; //ret;
+}
+
+/*
+ 处理一个边缘触发模式下已就绪的连接
+ @return 连接仍处于就绪状态且有事可做时返回true，需要在下次poll()时继续处理
+*/
+static bool et_process_conn(MultiplexNetThread<EpollETSelector>* t,
+	NetConnect* conn, uint32_t mode, uint32_t& bytes_recv, uint32_t& bytes_sent)
+{
+	bytes_recv = 0;
+	bytes_sent = 0;
+	if (mode&SELIN && conn->m_ready_events&SELIN)
+	{
+		bytes_recv = t->on_read_event(conn);
+	}
+	if (conn->m_state == NetConnectState::NET_CONN_CLOSED) return false;
+
+	if (mode&SELOUT && (conn->m_ready_events&SELOUT
+		|| (conn->m_state == NetConnectState::NET_CONN_CLOSING && conn->m_send_list.empty())))
+	{
+		bytes_sent = t->on_write_event(conn);
+	}
+	if (conn->m_state == NetConnectState::NET_CONN_CLOSED) return false;
+
+	return (conn->m_ready_events&SELIN) != 0
+		|| (conn->m_ready_events&SELOUT && !conn->m_send_list.empty());
+}
+
+int32_t EpollETSelector::poll(void* p_thread, uint32_t mode, uint32_t ms)
+{
+	int32_t ret = 0;
+	uint32_t bytes_sent_total = 0;
+	uint32_t bytes_recv_total = 0;
+	uint32_t bytes_sent;
+	uint32_t bytes_recv;
+	auto t = reinterpret_cast<MultiplexNetThread<EpollETSelector>*>(p_thread);
+	struct epoll_event evs[16];
+
+	//上次遗留的就绪连接，处理过程中新加入的留到下次
+	m_pending_swap.swap(m_pending);
+	for (auto fd : m_pending_swap)
+	{
+		m_pending_flag[static_cast<size_t>(fd)] = 0;
+		NetConnect* conn = t->get_conn(static_cast<uint32_t>(fd));
+		if (conn == nullptr || conn->m_state == NetConnectState::NET_CONN_CLOSED) continue;
+		if (et_process_conn(t, conn, mode, bytes_recv, bytes_sent)) add_pending(fd);
+		t->m_ss.sample(bytes_recv, bytes_sent);
+		bytes_sent_total += bytes_sent;
+		bytes_recv_total += bytes_recv;
+	}
+	m_pending_swap.clear();
+
+	ret = epoll_wait(m_fd, evs, 16, m_pending.empty() ? static_cast<int>(ms) : 0);
+	if(ret > 0)
+	{
+		for(int32_t i = 0; i<ret; ++i)
+		{
+			NetConnect* conn = static_cast<NetConnect*>(evs[i].data.ptr);
+			if(conn == nullptr)
+			{
+				drain_notify_fd(m_notify_fd);
+				continue;
+			}
+
+			if (evs[i].events & (EPOLLIN|EPOLLRDHUP|EPOLLHUP)) conn->m_ready_events |= SELIN;
+			if (evs[i].events & EPOLLOUT) conn->m_ready_events |= SELOUT;
+
+			bool again = et_process_conn(t, conn, mode, bytes_recv, bytes_sent);
+			if (evs[i].events & EPOLLERR
+				&& conn->m_state != NetConnectState::NET_CONN_CLOSED)
+			{
+				++bytes_recv;
+				t->on_error_event(conn);
+			}
+			//零拷贝完成通知也是EPOLLERR，连接未关闭时仍需继续处理
+			if (again && conn->m_state != NetConnectState::NET_CONN_CLOSED)
+			{
+				add_pending(conn->m_fd);
+			}
+
+			t->m_ss.sample(bytes_recv, bytes_sent);
+			bytes_sent_total += bytes_sent;
+			bytes_recv_total += bytes_recv;
+		}
+	}
+	else if(ret < 0)
+	{
+		t->m_ss.sample(0, 0);
+		_WARNLOG(logger, "epoll_wait fail:%d[%s]", errno, strerror(errno));
+	}
+	else if (bytes_sent_total + bytes_recv_total == 0)
+	{
+		t->m_ss.sample(0, 0);
+	}
+
+	return bytes_sent_total + bytes_recv_total;
+}
+
+} //end of namespace asyncpp
+
+#endif
+
+#ifndef _DISABLE_IO_URING
+
+namespace asyncpp
+{
+
+static int sys_io_uring_setup(uint32_t entries, struct io_uring_params* p)
+{
+	return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int sys_io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete,
+	uint32_t flags, const void* arg, size_t argsz)
+{
+	return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz));
+}
+
+UringSelector::UringSelector()
+	: m_fd(INVALID_SOCKET)
+	, m_notify_fd(INVALID_SOCKET)
+	, m_sq_head(nullptr)
+	, m_sq_tail(nullptr)
+	, m_sq_mask(0)
+	, m_sq_entries(0)
+	, m_sq_array(nullptr)
+	, m_sq_flags(nullptr)
+	, m_sqes(nullptr)
+	, m_sq_local_tail(0)
+	, m_cq_head(nullptr)
+	, m_cq_tail(nullptr)
+	, m_cq_mask(0)
+	, m_cqes(nullptr)
+	, m_sq_ring(MAP_FAILED)
+	, m_sq_ring_size(0)
+	, m_cq_ring(MAP_FAILED)
+	, m_cq_ring_size(0)
+	, m_sqes_size(0)
+	, m_slots()
+	, m_accept_ready()
+	, m_accept_ready_swap()
+	, m_multishot_accept(true)
+#ifndef _DISABLE_EPOLL
+	, m_fallback(nullptr)
+#endif
+{
+	if (setup() != 0)
+	{
+		release();
+#ifndef _DISABLE_EPOLL
+		_INFOLOG(logger, "io_uring not available, use epoll");
+		m_fallback = new EpollSelector();
+#else
+		fprintf(stderr, "io_uring_setup fail:%d[%s]\n", errno, strerror(errno));
+#endif
+	}
+}
+
+UringSelector::~UringSelector()
+{
+	for (auto& s : m_slots) drop_accepted(s);
+	release();
+#ifndef _DISABLE_EPOLL
+	delete m_fallback;
+#endif
+}
+
+int32_t UringSelector::setup()
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof p);
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = _ASYNCPP_URING_ENTRIES * 4;
+	m_fd = sys_io_uring_setup(_ASYNCPP_URING_ENTRIES, &p);
+	if (m_fd < 0)
+	{
+		m_fd = INVALID_SOCKET;
+		return -1;
+	}
+	//需要带超时的等待，且完成队列溢出时不丢事件
+	if (!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP))
+	{
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	m_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	m_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (m_cq_ring_size > m_sq_ring_size) m_sq_ring_size = m_cq_ring_size;
+		m_cq_ring_size = m_sq_ring_size;
+	}
+	m_sq_ring = mmap(nullptr, m_sq_ring_size, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+	if (m_sq_ring == MAP_FAILED) return -1;
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		m_cq_ring = m_sq_ring;
+	}
+	else
+	{
+		m_cq_ring = mmap(nullptr, m_cq_ring_size, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+		if (m_cq_ring == MAP_FAILED) return -1;
+	}
+	m_sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	void* sqes = mmap(nullptr, m_sqes_size, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, m_fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) return -1;
+	m_sqes = static_cast<struct io_uring_sqe*>(sqes);
+
+	char* sq = static_cast<char*>(m_sq_ring);
+	m_sq_head = reinterpret_cast<uint32_t*>(sq + p.sq_off.head);
+	m_sq_tail = reinterpret_cast<uint32_t*>(sq + p.sq_off.tail);
+	m_sq_mask = *reinterpret_cast<uint32_t*>(sq + p.sq_off.ring_mask);
+	m_sq_entries = *reinterpret_cast<uint32_t*>(sq + p.sq_off.ring_entries);
+	m_sq_array = reinterpret_cast<uint32_t*>(sq + p.sq_off.array);
+	m_sq_flags = reinterpret_cast<uint32_t*>(sq + p.sq_off.flags);
+	m_sq_local_tail = *m_sq_tail;
+
+	char* cq = static_cast<char*>(m_cq_ring);
+	m_cq_head = reinterpret_cast<uint32_t*>(cq + p.cq_off.head);
+	m_cq_tail = reinterpret_cast<uint32_t*>(cq + p.cq_off.tail);
+	m_cq_mask = *reinterpret_cast<uint32_t*>(cq + p.cq_off.ring_mask);
+	m_cqes = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+	return 0;
+}
+
+void UringSelector::release()
+{
+	if (m_sqes != nullptr) munmap(m_sqes, m_sqes_size);
+	if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring) munmap(m_cq_ring, m_cq_ring_size);
+	if (m_sq_ring != MAP_FAILED) munmap(m_sq_ring, m_sq_ring_size);
+	if (m_fd != INVALID_SOCKET) close(m_fd);
+	m_sqes = nullptr;
+	m_sq_flags = nullptr;
+	m_cq_ring = m_sq_ring = MAP_FAILED;
+	m_fd = INVALID_SOCKET;
+}
+
+struct io_uring_sqe* UringSelector::get_sqe()
+{
+	if (m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_entries)
+	{ //提交队列已满，先提交
+		enter(false, 0);
+		if (m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_entries)
+		{
+			return nullptr;
+		}
+	}
+	uint32_t idx = m_sq_local_tail & m_sq_mask;
+	struct io_uring_sqe* sqe = &m_sqes[idx];
+	memset(sqe, 0, sizeof *sqe);
+	m_sq_array[idx] = idx;
+	++m_sq_local_tail;
+	return sqe;
+}
+
+int32_t UringSelector::enter(bool wait, uint32_t ms)
+{
+	uint32_t to_submit = m_sq_local_tail - *m_sq_tail;
+	__atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+	//完成队列溢出时内核暂存的完成事件(NODROP)，只有带GETEVENTS进入内核才会转入完成队列
+	bool overflow = (__atomic_load_n(m_sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_CQ_OVERFLOW) != 0;
+	if (!wait && to_submit == 0 && !overflow) return 0;
+
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	memset(&arg, 0, sizeof arg);
+	if (wait && ms != UINT32_MAX)
+	{
+		ts.tv_sec = ms / 1000;
+		ts.tv_nsec = (ms % 1000) * 1000000ll;
+		arg.ts = reinterpret_cast<uint64_t>(&ts);
+	}
+	uint32_t flags = IORING_ENTER_EXT_ARG;
+	if (wait || overflow) flags |= IORING_ENTER_GETEVENTS;
+	int ret = sys_io_uring_enter(m_fd, to_submit, wait ? 1 : 0, flags, &arg, sizeof arg);
+	if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY)
+	{
+		_WARNLOG(logger, "io_uring_enter fail:%d[%s]", errno, strerror(errno));
+	}
+	return ret;
+}
+
+void UringSelector::arm(SOCKET_HANDLE fd)
+{
+	FdSlot& s = m_slots[fd];
+	struct io_uring_sqe* sqe = get_sqe();
+	if (sqe == nullptr)
+	{
+		_WARNLOG(logger, "io_uring sq full, sockfd:%d", fd);
+		return;
+	}
+	s.armed = true;
+	if (s.accept)
+	{ //连接直接设为非阻塞，与accept4一致
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->fd = fd;
+		sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+		sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+		sqe->user_data = make_user_data(fd, s.gen, true);
+		return;
+	}
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	uint32_t events = fd == m_notify_fd ? POLLIN : to_poll_events(s.events);
+#if __BYTE_ORDER == __BIG_ENDIAN
+	events = (events << 16) | (events >> 16);
+#endif
+	sqe->poll32_events = events;
+	sqe->user_data = make_user_data(fd, s.gen);
+}
+
+void UringSelector::cancel(SOCKET_HANDLE fd)
+{
+	FdSlot& s = m_slots[fd];
+	if (s.armed)
+	{
+		struct io_uring_sqe* sqe = get_sqe();
+		if (sqe != nullptr)
+		{
+			sqe->opcode = s.accept ? IORING_OP_ASYNC_CANCEL : IORING_OP_POLL_REMOVE;
+			sqe->fd = -1;
+			sqe->addr = make_user_data(fd, s.gen, s.accept);
+			sqe->user_data = CANCEL_USER_DATA;
+		}
+		s.armed = false;
+	}
+	++s.gen; //已在内核中的POLL_ADD即使先于删除完成也会被丢弃
+}
+
+int32_t UringSelector::modify(SOCKET_HANDLE fd, uint32_t sel_events)
+{
+#ifndef _DISABLE_EPOLL
+	if (m_fallback != nullptr)
+	{
+		if (sel_events == SELIN) return m_fallback->set_read_event(fd);
+		else if (sel_events == SELOUT) return m_fallback->set_write_event(fd);
+		else return m_fallback->set_read_write_event(fd);
+	}
+#endif
+	assert(fd != INVALID_SOCKET);
+	if (static_cast<size_t>(fd) >= m_slots.size() || m_slots[fd].events == 0)
+	{
+		errno = ENOENT;
+		return -1;
+	}
+	FdSlot& s = m_slots[fd];
+	if (s.events == sel_events) return 0;
+	s.events = sel_events;
+	if (s.accept) return 0; //multishot accept与关注的事件无关
+	if (s.armed)
+	{ //未挂载时(正在分发完成事件)，分发结束后会按新的事件挂载
+		cancel(fd);
+		arm(fd);
+	}
+	return 0;
+}
+
+int32_t UringSelector::add(SOCKET_HANDLE fd, NetConnectState state, void* ctx)
+{
+#ifndef _DISABLE_EPOLL
+	if (m_fallback != nullptr) return m_fallback->add(fd, state, ctx);
+#endif
+	assert(ctx != nullptr);
+	uint32_t events;
+	if (state == NetConnectState::NET_CONN_CONNECTED)
+	{
+		events = SELIN | SELOUT;
+	}
+	else if (state == NetConnectState::NET_CONN_LISTENING)
+	{
+		events = SELIN;
+	}
+	else if (state == NetConnectState::NET_CONN_CONNECTING)
+	{
+		events = SELOUT;
+	}
+	else
+	{
+		assert(0);
+		return EINVAL;
+	}
+	FdSlot* s = slot(fd);
+	if (s->events != 0)
+	{
+		cancel(fd);
+		drop_accepted(*s);
+	}
+	s->ctx = ctx;
+	s->events = events;
+	s->accept = state == NetConnectState::NET_CONN_LISTENING && m_multishot_accept;
+	arm(fd);
+	return 0;
+}
+
+int32_t UringSelector::del(SOCKET_HANDLE fd)
+{
+#ifndef _DISABLE_EPOLL
+	if (m_fallback != nullptr) return m_fallback->del(fd);
+#endif
+	assert(fd != INVALID_SOCKET);
+	if (static_cast<size_t>(fd) >= m_slots.size() || m_slots[fd].events == 0)
+	{
+		errno = ENOENT;
+		return -1;
+	}
+	cancel(fd);
+	drop_accepted(m_slots[fd]);
+	m_slots[fd].ctx = nullptr;
+	m_slots[fd].events = 0;
+	m_slots[fd].accept = false;
+	return 0;
+}
+
+void UringSelector::drop_accepted(FdSlot& s)
+{
+	for (auto client : s.accepted) close(client);
+	s.accepted.clear();
+	s.accept_err = 0;
+	s.accept_ready = false; //m_accept_ready中残留的fd在分发时跳过
+}
+
+int32_t UringSelector::accept(SOCKET_HANDLE listen_fd, SOCKET_HANDLE& fd)
+{
+	if (m_fd == INVALID_SOCKET || static_cast<size_t>(listen_fd) >= m_slots.size()
+		|| !m_slots[listen_fd].accept)
+	{
+		return ENOTSUP;
+	}
+	FdSlot& s = m_slots[listen_fd];
+	if (!s.accepted.empty())
+	{
+		fd = s.accepted.front();
+		s.accepted.pop_front();
+		return 0;
+	}
+	if (s.accept_err != 0)
+	{
+		int32_t err = s.accept_err;
+		s.accept_err = 0;
+		return err;
+	}
+	return EAGAIN;
+}
+
+void UringSelector::on_accept_cqe(SOCKET_HANDLE fd, int32_t res, uint32_t flags)
+{
+	FdSlot& s = m_slots[fd];
+	if (!(flags & IORING_CQE_F_MORE)) s.armed = false; //multishot已结束(出错或完成队列溢出)
+	if (res >= 0)
+	{
+		s.accepted.push_back(res);
+	}
+	else if (res == -EINVAL && s.accepted.empty() && m_multishot_accept)
+	{ //内核不支持IORING_ACCEPT_MULTISHOT，之后都改用POLL_ADD
+		_INFOLOG(logger, "multishot accept not supported, use poll");
+		m_multishot_accept = false;
+		s.accept = false;
+	}
+	else if (res != -ECANCELED)
+	{
+		s.accept_err = -res;
+	}
+
+	if (!s.accept_ready && (!s.accepted.empty() || s.accept_err != 0))
+	{
+		s.accept_ready = true;
+		m_accept_ready.push_back(fd);
+	}
+	if (!s.armed && s.events != 0) arm(fd);
+}
+
+int32_t UringSelector::set_notify_fd(SOCKET_HANDLE fd)
+{
+#ifndef _DISABLE_EPOLL
+	if (m_fallback != nullptr) return m_fallback->set_notify_fd(fd);
+#endif
+	if (m_fd == INVALID_SOCKET) return -1;
+	slot(fd);
+	m_notify_fd = fd;
+	arm(fd);
+	return 0;
+}
+
+int32_t UringSelector::poll(void* p_thread, uint32_t mode, uint32_t ms)
+{
+#ifndef _DISABLE_EPOLL
+	if (m_fallback != nullptr) return m_fallback->poll(p_thread, mode, ms);
+#endif
+	uint32_t bytes_sent_total = 0;
+	uint32_t bytes_recv_total = 0;
+	auto t = reinterpret_cast<MultiplexNetThread<UringSelector>*>(p_thread);
+
+	//已有完成事件或待取走的连接时不等待
+	bool wait = ms != 0
+		&& __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE) == *m_cq_head
+		&& (m_accept_ready.empty() || !(mode&SELIN));
+	int32_t ret = enter(wait, ms);
+	if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY)
+	{
+		t->m_ss.sample(0, 0);
+		return 0;
+	}
+
+	uint32_t head = *m_cq_head;
+	uint32_t tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+	uint32_t n = 0;
+	for (; head != tail; ++head)
+	{
+		const struct io_uring_cqe& cqe = m_cqes[head & m_cq_mask];
+		uint64_t user_data = cqe.user_data;
+		int32_t res = cqe.res;
+		if (user_data == CANCEL_USER_DATA) continue;
+
+		bool is_accept = (user_data & ACCEPT_USER_DATA_FLAG) != 0;
+		SOCKET_HANDLE fd = static_cast<SOCKET_HANDLE>(user_data & (ACCEPT_USER_DATA_FLAG - 1));
+		uint32_t gen = static_cast<uint32_t>(user_data >> 32);
+		if (static_cast<size_t>(fd) >= m_slots.size() || m_slots[fd].gen != gen)
+		{ //已删除的监听socket在取消前accept到的连接
+			if (is_accept && res >= 0) close(res);
+			continue;
+		}
+		++n;
+		if (is_accept)
+		{
+			on_accept_cqe(fd, res, cqe.flags);
+			continue;
+		}
+		m_slots[fd].armed = false;
+
+		if (fd == m_notify_fd)
+		{
+			drain_notify_fd(m_notify_fd);
+			arm(fd);
+			continue;
+		}
+
+		NetConnect* conn = static_cast<NetConnect*>(m_slots[fd].ctx);
+		uint32_t bytes_sent = 0;
+		uint32_t bytes_recv = 0;
+		uint32_t revents = res < 0 ? POLLERR : static_cast<uint32_t>(res);
+
+		if (mode&SELIN && revents&POLLIN)
+		{
+			bytes_recv = t->on_read_event(conn);
+		}
+		if (mode&SELOUT && revents&POLLOUT)
+		{
+			bytes_sent = t->on_write_event(conn);
+		}
+		if (revents & POLLERR)
+		{
+			++bytes_recv;
+			t->on_error_event(conn);
+		}
+
+		t->m_ss.sample(bytes_recv, bytes_sent);
+		bytes_sent_total += bytes_sent;
+		bytes_recv_total += bytes_recv;
+
+		//分发过程中可能已被删除或重新挂载
+		if (m_slots[fd].gen == gen && !m_slots[fd].armed && m_slots[fd].events != 0)
+		{
+			arm(fd);
+		}
+	}
+	__atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+
+	if (mode&SELIN && !m_accept_ready.empty())
+	{ //do_accept通过accept()取走连接，分发中可能删除监听socket或产生新的待取连接
+		m_accept_ready_swap.swap(m_accept_ready);
+		for (auto fd : m_accept_ready_swap)
+		{
+			FdSlot& s = m_slots[fd];
+			if (!s.accept_ready) continue;
+			s.accept_ready = false;
+			if (s.events == 0) continue;
+			uint32_t bytes_recv = t->on_read_event(static_cast<NetConnect*>(s.ctx));
+			t->m_ss.sample(bytes_recv, 0);
+			bytes_recv_total += bytes_recv;
+			++n;
+			//一次没有取完(例如被限速)，下一轮继续
+			if (!s.accept_ready && s.events != 0 && (!s.accepted.empty() || s.accept_err != 0))
+			{
+				s.accept_ready = true;
+				m_accept_ready.push_back(fd);
+			}
+		}
+		m_accept_ready_swap.clear();
+	}
+
+	if (n == 0) t->m_ss.sample(0, 0);
+	return bytes_sent_total + bytes_recv_total;
+}
+
+template<>
+SOCKET_HANDLE MultiplexNetThread<UringSelector>::accept_client(NetConnect* listener, AcceptedClient& client)
+{
+	int32_t ret = m_selector.accept(listener->m_fd, client.fd);
+	if (ret == ENOTSUP) return NetBaseThread::accept_client(listener, client);
+	if (ret != 0)
+	{
+		errno = ret;
+		return client.fd = INVALID_SOCKET;
+	}
+	//multishot accept共用一个地址缓冲区，对端地址另行查询
+	struct sockaddr_storage addr;
+	socklen_t len = sizeof addr;
+	if (getpeername(client.fd, reinterpret_cast<struct sockaddr*>(&addr), &len) == 0
+		&& addr.ss_family == AF_INET)
+	{
+		memcpy(&client.addr, &addr, sizeof client.addr);
+	}
+	else memset(&client.addr, 0, sizeof client.addr);
+	return client.fd;
+}
+
+} //end of namespace asyncpp
+
+#endif
+
+#ifndef _DISABLE_POLL
+
+namespace asyncpp
+{
+
+void PollSelector::compact()
+{
+	//从大到小移除，保证换到前面的末尾元素不是待移除的
+	std::sort(m_removed.begin(), m_removed.end(), std::greater<int32_t>());
+	for (auto idx : m_removed)
+	{
+		int32_t last = static_cast<int32_t>(m_pfds.size()) - 1;
+		if (idx != last)
+		{
+			m_pfds[idx] = m_pfds[last];
+			m_ctxs[idx] = m_ctxs[last];
+			m_events[idx] = m_events[last];
+			m_index[m_pfds[idx].fd] = idx;
+		}
+		m_pfds.pop_back();
+		m_ctxs.pop_back();
+		m_events.pop_back();
+	}
+	m_removed.clear();
+}
+
+int32_t PollSelector::poll(void* p_thread, uint32_t mode, uint32_t ms)
+{
+	uint32_t bytes_sent_total = 0;
+	uint32_t bytes_recv_total = 0;
+	auto t = reinterpret_cast<MultiplexNetThread<PollSelector>*>(p_thread);
+
+	if (!m_removed.empty()) compact();
+	if (mode != m_mode)
+	{ //限速状态变化，被限速的方向不再关注
+		m_mode = mode;
+		for (size_t i = 0; i < m_pfds.size(); ++i)
+		{
+			if (m_pfds[i].fd == m_notify_fd) continue;
+			m_pfds[i].events = to_poll_events(m_events[i] & mode);
+		}
+	}
+	if (m_pfds.empty())
+	{
+		t->m_ss.sample(0, 0);
+		return 0;
+	}
+
+	int32_t cnt = static_cast<int32_t>(m_pfds.size());
+	int n = ::poll(m_pfds.data(), static_cast<nfds_t>(cnt),
+		ms == UINT32_MAX ? -1 : static_cast<int>(ms));
+	if (n > 0)
+	{
+		uint32_t bytes_sent;
+		uint32_t bytes_recv;
+		int32_t rp = rand() % cnt;
+		//分发过程中新增的连接在数组末尾，本轮不处理
+		for (int32_t k = 0; k < cnt && n > 0; ++k)
 		{
-			NetConnect* conn = t->get_conn(static_cast<uint32_t>(evs[i].data.fd));
+			int32_t i = rp + k < cnt ? rp + k : rp + k - cnt;
+			short revents = m_pfds[i].revents;
+			if (revents == 0 || m_pfds[i].fd < 0) continue;
+			m_pfds[i].revents = 0;
+			--n;
+
+			if (m_pfds[i].fd == m_notify_fd)
+			{
+				drain_notify_fd(m_notify_fd);
+				continue;
+			}
+			NetConnect* conn = static_cast<NetConnect*>(m_ctxs[i]);
 
-			if(mode&SELIN && evs[i].events&EPOLLIN)
+			if (mode&SELIN && revents&POLLIN)
 			{
 				bytes_recv = t->on_read_event(conn);
-				///TODO: 出错中断，防止重复on_error_event
 			}
 			else bytes_recv = 0;
 
-			if(mode&SELOUT && evs[i].events&EPOLLOUT)
+			//on_read_event中可能已关闭连接
+			if (mode&SELOUT && revents&POLLOUT && m_pfds[i].fd >= 0)
 			{
 				bytes_sent = t->on_write_event(conn);
 			}
 			else bytes_sent = 0;
 
-			if(evs[i].events & EPOLLERR)
+			if (revents & (POLLERR|POLLNVAL) && m_pfds[i].fd >= 0)
 			{
 				++bytes_recv;
 				t->on_error_event(conn);
@@ -82,18 +813,17 @@ int32_t EpollSelector::poll(void* p_thread, uint32_t mode, uint32_t ms)
 			bytes_recv_total += bytes_recv;
 		}
 	}
-	else if(ret < 0)
+	else if (n < 0)
 	{
 		t->m_ss.sample(0, 0);
-		_WARNLOG(logger, "epoll_wait fail:%d[%s]", errno, strerror(errno));
+		if (errno != EINTR) _WARNLOG(logger, "poll fail:%d[%s], nfds:%d", errno, strerror(errno), cnt);
 	}
 	else
 	{
 		t->m_ss.sample(0, 0);
 	}
-		
-	//t->m_ss.sample(bytes_recv_total, bytes_sent_total);
-	return bytes_sent_total + bytes_recv_total; //ret;
+
+	return bytes_sent_total + bytes_recv_total;
 }
 
 } //end of namespace asyncpp
@@ -192,6 +922,7 @@ int32_t SelSelector::poll(void* p_thread, uint32_t mode, uint32_t ms)
 	uint32_t bytes_recv_total = 0;
 	struct timeval tv = { static_cast<decltype(tv.tv_sec)>(ms / 1000),
 		static_cast<decltype(tv.tv_usec)>((ms % 1000) * 1000) };
+	struct timeval* ptv = ms != UINT32_MAX ? &tv : nullptr;
 	auto t = reinterpret_cast<MultiplexNetThread<SelSelector>*>(p_thread);
 	SOCKET_HANDLE max_fd = 0;
 	std::unordered_map<SOCKET_HANDLE, uint32_t>::const_iterator record_point;
@@ -208,9 +939,9 @@ int32_t SelSelector::poll(void* p_thread, uint32_t mode, uint32_t ms)
 		for (auto fd : m_removed_fds) m_fds.erase(fd);
 		m_removed_fds.clear();
 	}
-	if (m_fds.empty()) return 0;
+	if (m_fds.empty() && m_notify_fd == INVALID_SOCKET) return 0;
 
-	rp = rand() % (int32_t)m_fds.size();
+	rp = !m_fds.empty() ? rand() % (int32_t)m_fds.size() : 0;
 	record_point = m_fds.begin();
 	for (auto it = record_point; it != m_fds.end(); ++it)
 	{
@@ -231,15 +962,26 @@ int32_t SelSelector::poll(void* p_thread, uint32_t mode, uint32_t ms)
 		++n;
 		FD_SET(it->first, &except_fds);
 	}
-	if (n == 0)
+	if (m_notify_fd != INVALID_SOCKET)
+	{
+		if (m_notify_fd > max_fd) max_fd = m_notify_fd;
+		FD_SET(m_notify_fd, &read_fds);
+	}
+	else if (n == 0)
 	{
 		t->m_ss.sample(0, 0);
 		goto L_RET;
 	}
 
-	n = select(static_cast<int>(max_fd + 1), &read_fds, &write_fds, &except_fds, &tv);
+	n = select(static_cast<int>(max_fd + 1), &read_fds, &write_fds, &except_fds, ptv);
 	if (n > 0)
 	{
+#ifndef _WIN32
+		if (m_notify_fd != INVALID_SOCKET && FD_ISSET(m_notify_fd, &read_fds))
+		{
+			drain_notify_fd(m_notify_fd);
+		}
+#endif
 		uint32_t bytes_sent;
 		uint32_t bytes_recv;
 		for (auto it = record_point; it != m_fds.end(); ++it)
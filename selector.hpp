@@ -5,6 +5,7 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <algorithm>
+#include <functional>
 #include <cstdint>
 #include <cstring>
 #include <cstdio>
@@ -42,6 +43,9 @@ enum SELEVENTS {SELIN = 1, SELOUT = 2};
 #include <sys/time.h>
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <limits.h>
 
 /*FOR SELECT*/
 #ifndef _DISABLE_SELECT
@@ -55,6 +59,33 @@ enum SELEVENTS {SELIN = 1, SELOUT = 2};
 #include <sys/epoll.h>
 #endif
 
+/*FOR IO_URING*/
+#if !defined(__linux__)
+#define _DISABLE_IO_URING
+#elif defined(__has_include)
+#if !__has_include(<linux/io_uring.h>)
+#define _DISABLE_IO_URING
+#endif
+#endif
+#ifndef _DISABLE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <deque>
+#ifndef IORING_ACCEPT_MULTISHOT //头文件较旧时按内核5.19+的定义，运行时不支持再退回POLL_ADD
+#define IORING_ACCEPT_MULTISHOT (1U << 0)
+#endif
+#ifndef IORING_CQE_F_MORE
+#define IORING_CQE_F_MORE (1U << 1)
+#endif
+#ifndef IORING_SQ_CQ_OVERFLOW
+#define IORING_SQ_CQ_OVERFLOW (1U << 1)
+#endif
+#endif
+
+/*FOR POLL*/
+#include <poll.h>
+
 #define SOCKET_HANDLE int
 namespace asyncpp
 {
@@ -79,12 +110,54 @@ const int INVALID_SOCKET = -1;
 namespace asyncpp
 {
 
+#ifndef _ASYNCPP_EPOLL_MIN_EVENTS
+#define _ASYNCPP_EPOLL_MIN_EVENTS 16 //每次epoll_wait最少取的事件数
+#endif
+#ifndef _ASYNCPP_EPOLL_MAX_EVENTS
+#define _ASYNCPP_EPOLL_MAX_EVENTS 1024 //每次epoll_wait最多取的事件数
+#endif
+
+/*
+ epoll_event.data中保存add()传入的ctx(NetConnect*)，poll()时不再按fd查找连接
+ 已注册的事件按fd缓存，事件未变化时不调用epoll_ctl
+ 每次epoll_wait取的事件数根据上次返回的数量在[MIN, MAX]之间调整
+*/
 class EpollSelector
 {
 private:
+	struct FdSlot
+	{
+		void* ctx;
+		uint32_t events; //已注册的事件，0表示未注册
+	};
 	SOCKET_HANDLE m_fd;
+	SOCKET_HANDLE m_notify_fd;
+	std::vector<FdSlot> m_slots; //下标为fd
+	std::vector<struct epoll_event> m_evs;
+
+	int32_t modify(SOCKET_HANDLE fd, uint32_t events)
+	{
+		assert(fd != INVALID_SOCKET);
+		if (static_cast<size_t>(fd) >= m_slots.size() || m_slots[fd].events == 0)
+		{
+			errno = ENOENT;
+			return -1;
+		}
+		FdSlot& slot = m_slots[fd];
+		if (slot.events == events) return 0;
+
+		struct epoll_event ev;
+		ev.events = events;
+		ev.data.ptr = slot.ctx;
+		int32_t ret = epoll_ctl(m_fd, EPOLL_CTL_MOD, fd, &ev);
+		if (ret == 0) slot.events = events;
+		return ret;
+	}
 public:
 	EpollSelector()
+		: m_notify_fd(INVALID_SOCKET)
+		, m_slots()
+		, m_evs(_ASYNCPP_EPOLL_MIN_EVENTS)
 	{
 		m_fd = epoll_create(102400);
 		assert(m_fd != INVALID_SOCKET);
@@ -100,10 +173,14 @@ public:
 	EpollSelector(const EpollSelector&) = delete;
 	EpollSelector& operator=(const EpollSelector&) = delete;
 
-	int32_t add(SOCKET_HANDLE fd, NetConnectState state)
+	/*
+	 @param ctx 事件就绪时传给poll()的NetConnect*，不能为空
+	*/
+	int32_t add(SOCKET_HANDLE fd, NetConnectState state, void* ctx)
 	{
 		struct epoll_event ev;
 		assert(fd != INVALID_SOCKET);
+		assert(ctx != nullptr);
 		if (state == NetConnectState::NET_CONN_CONNECTED)
 		{
 			ev.events = EPOLLIN|EPOLLOUT;
@@ -120,42 +197,460 @@ public:
 		{
 			assert(0);
 		}
-		ev.data.fd = fd;
+		ev.data.ptr = ctx;
 		int32_t ret = epoll_ctl(m_fd, EPOLL_CTL_ADD, fd, &ev);
 		assert(ret == 0);
+		if (ret == 0)
+		{
+			if (static_cast<size_t>(fd) >= m_slots.size()) m_slots.resize(fd + 1, FdSlot{nullptr, 0});
+			m_slots[fd].ctx = ctx;
+			m_slots[fd].events = ev.events;
+		}
 		return ret;
 	}
 	int32_t del(SOCKET_HANDLE fd)
 	{
 		struct epoll_event ev;
 		assert(fd != INVALID_SOCKET);
+		if (static_cast<size_t>(fd) < m_slots.size())
+		{
+			m_slots[fd].ctx = nullptr;
+			m_slots[fd].events = 0;
+		}
 		return epoll_ctl(m_fd, EPOLL_CTL_DEL, fd, &ev);
 	}
 	int32_t set_read_event(SOCKET_HANDLE fd)
+	{
+		return modify(fd, EPOLLIN);
+	}
+	int32_t set_write_event(SOCKET_HANDLE fd)
+	{
+		return modify(fd, EPOLLOUT);
+	}
+	int32_t set_read_write_event(SOCKET_HANDLE fd)
+	{
+		return modify(fd, EPOLLIN|EPOLLOUT);
+	}
+
+	/*
+	 注册线程唤醒fd，该fd可读时poll()提前返回
+	*/
+	int32_t set_notify_fd(SOCKET_HANDLE fd)
 	{
 		struct epoll_event ev;
-		assert(fd != INVALID_SOCKET);
 		ev.events = EPOLLIN;
-		ev.data.fd = fd;
-		return epoll_ctl(m_fd, EPOLL_CTL_MOD, fd, &ev);
+		ev.data.ptr = nullptr;
+		int32_t ret = epoll_ctl(m_fd, EPOLL_CTL_ADD, fd, &ev);
+		if (ret == 0) m_notify_fd = fd;
+		return ret;
 	}
-	int32_t set_write_event(SOCKET_HANDLE fd)
+
+	/*
+	 @param ms 最长等待时间，UINT32_MAX表示一直等待
+	*/
+	int32_t poll(void* p_thread, uint32_t mode, uint32_t ms);
+};
+
+/*
+ 边缘触发的epoll，每个fd只在添加时注册一次EPOLLIN|EPOLLOUT|EPOLLRDHUP|EPOLLET
+ 就绪状态记录在NetConnect::m_ready_events中，do_recv/do_send读写到EAGAIN后清除
+ set_*_event不再调用epoll_ctl，只把fd放入待处理列表，
+ 下次poll()时对仍处于就绪状态且有事可做的连接直接进行读写
+*/
+class EpollETSelector
+{
+private:
+	SOCKET_HANDLE m_fd;
+	SOCKET_HANDLE m_notify_fd;
+	std::vector<SOCKET_HANDLE> m_pending; //已就绪、等待在下次poll()时处理的fd
+	std::vector<SOCKET_HANDLE> m_pending_swap;
+	std::vector<uint8_t> m_pending_flag; //按fd标记是否已在m_pending中，同一fd只加入一次
+
+	void add_pending(SOCKET_HANDLE fd)
+	{
+		size_t idx = static_cast<size_t>(fd);
+		if (idx >= m_pending_flag.size()) m_pending_flag.resize(idx + 1);
+		if (m_pending_flag[idx] != 0) return;
+		m_pending_flag[idx] = 1;
+		m_pending.push_back(fd);
+	}
+public:
+	EpollETSelector()
+		: m_notify_fd(INVALID_SOCKET)
+		, m_pending()
+		, m_pending_swap()
+		, m_pending_flag()
+	{
+		m_fd = epoll_create(102400);
+		assert(m_fd != INVALID_SOCKET);
+		if(m_fd == INVALID_SOCKET)
+		{
+			fprintf(stderr, "epoll_create fail:%d[%s]\n", errno, strerror(errno));
+		}
+	}
+	~EpollETSelector()
+	{
+		close(m_fd);
+	}
+	EpollETSelector(const EpollETSelector&) = delete;
+	EpollETSelector& operator=(const EpollETSelector&) = delete;
+
+	/*
+	 @param ctx 事件就绪时传给poll()的NetConnect*，不能为空
+	*/
+	int32_t add(SOCKET_HANDLE fd, NetConnectState state, void* ctx)
 	{
 		struct epoll_event ev;
 		assert(fd != INVALID_SOCKET);
-		ev.events = EPOLLOUT;
-		ev.data.fd = fd;
-		return epoll_ctl(m_fd, EPOLL_CTL_MOD, fd, &ev);
+		assert(ctx != nullptr);
+		if (state == NetConnectState::NET_CONN_LISTENING)
+		{
+			ev.events = EPOLLIN|EPOLLET;
+		}
+		else
+		{
+			ev.events = EPOLLIN|EPOLLOUT|EPOLLRDHUP|EPOLLET;
+		}
+		ev.data.ptr = ctx;
+		int32_t ret = epoll_ctl(m_fd, EPOLL_CTL_ADD, fd, &ev);
+		assert(ret == 0);
+		return ret;
+	}
+	int32_t del(SOCKET_HANDLE fd)
+	{
+		struct epoll_event ev;
+		assert(fd != INVALID_SOCKET);
+		return epoll_ctl(m_fd, EPOLL_CTL_DEL, fd, &ev);
+	}
+	int32_t set_read_event(SOCKET_HANDLE fd)
+	{
+		return 0;
+	}
+	int32_t set_write_event(SOCKET_HANDLE fd)
+	{
+		add_pending(fd);
+		return 0;
 	}
 	int32_t set_read_write_event(SOCKET_HANDLE fd)
+	{
+		add_pending(fd);
+		return 0;
+	}
+
+	int32_t set_notify_fd(SOCKET_HANDLE fd)
 	{
 		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = nullptr;
+		int32_t ret = epoll_ctl(m_fd, EPOLL_CTL_ADD, fd, &ev);
+		if (ret == 0) m_notify_fd = fd;
+		return ret;
+	}
+
+	/*
+	 @param ms 最长等待时间，UINT32_MAX表示一直等待；有待处理的fd时不等待
+	*/
+	int32_t poll(void* p_thread, uint32_t mode, uint32_t ms);
+};
+
+} //end of namespace asyncpp
+
+#endif
+
+#ifndef _DISABLE_IO_URING
+
+#ifndef _ASYNCPP_URING_ENTRIES
+#define _ASYNCPP_URING_ENTRIES 4096 //提交队列长度，完成队列为其4倍
+#endif
+
+namespace asyncpp
+{
+
+/*
+ 基于io_uring的selector，语义与EpollSelector相同(水平触发)
+ 每个fd挂一个单次的IORING_OP_POLL_ADD，完成后分发给on_read_event/on_write_event再重新挂上，
+ 挂载、修改、删除都只写入提交队列，每次poll()用一次io_uring_enter提交并等待，不再有epoll_ctl
+ 监听socket挂multishot的IORING_OP_ACCEPT(内核5.19+)，内核accept好的连接在poll()中收集，
+ 再由do_accept通过accept()取走，不再逐个调用accept4；不支持时退回POLL_ADD
+ recv/send仍由do_recv/do_send各自发起系统调用
+ 内核不支持io_uring(或缺少IORING_FEAT_EXT_ARG/IORING_FEAT_NODROP)时退化为EpollSelector
+*/
+class UringSelector
+{
+private:
+	struct FdSlot
+	{
+		void* ctx;
+		uint32_t events; //关注的事件(POLLIN/POLLOUT)，0表示未注册
+		uint32_t gen; //每次重新挂载或删除时加1，用于丢弃过期的完成事件
+		bool armed; //已有POLL_ADD/ACCEPT在内核中或提交队列中
+		bool accept; //监听socket，使用multishot accept
+		bool accept_ready; //已在m_accept_ready中
+		int32_t accept_err; //multishot accept报告的错误，由accept()返回一次
+		std::deque<SOCKET_HANDLE> accepted; //已accept、尚未被取走的连接
+
+		FdSlot() : ctx(nullptr), events(0), gen(0), armed(false),
+			accept(false), accept_ready(false), accept_err(0), accepted() {}
+	};
+	static const uint64_t CANCEL_USER_DATA = UINT64_MAX;
+	static const uint64_t ACCEPT_USER_DATA_FLAG = 0x80000000u; //fd不会用到最高位
+
+	SOCKET_HANDLE m_fd;
+	SOCKET_HANDLE m_notify_fd;
+	uint32_t* m_sq_head;
+	uint32_t* m_sq_tail;
+	uint32_t m_sq_mask;
+	uint32_t m_sq_entries;
+	uint32_t* m_sq_array;
+	uint32_t* m_sq_flags;
+	struct io_uring_sqe* m_sqes;
+	uint32_t m_sq_local_tail; //已填写但未提交的sqe的尾部
+	uint32_t* m_cq_head;
+	uint32_t* m_cq_tail;
+	uint32_t m_cq_mask;
+	struct io_uring_cqe* m_cqes;
+	void* m_sq_ring;
+	size_t m_sq_ring_size;
+	void* m_cq_ring;
+	size_t m_cq_ring_size;
+	size_t m_sqes_size;
+	std::vector<FdSlot> m_slots; //下标为fd
+	std::vector<SOCKET_HANDLE> m_accept_ready; //有待取走的连接或错误的监听socket
+	std::vector<SOCKET_HANDLE> m_accept_ready_swap;
+	bool m_multishot_accept; //运行时发现内核不支持后置为false
+#ifndef _DISABLE_EPOLL
+	EpollSelector* m_fallback;
+#endif
+
+	static uint64_t make_user_data(SOCKET_HANDLE fd, uint32_t gen, bool accept = false)
+	{
+		return (static_cast<uint64_t>(gen) << 32) | static_cast<uint32_t>(fd)
+			| (accept ? ACCEPT_USER_DATA_FLAG : 0);
+	}
+	static uint32_t to_poll_events(uint32_t sel_events)
+	{
+		return (sel_events & SELIN ? POLLIN : 0) | (sel_events & SELOUT ? POLLOUT : 0);
+	}
+
+	int32_t setup();
+	void release();
+	struct io_uring_sqe* get_sqe();
+	/*
+	 提交所有sqe，wait为真时最多等待ms毫秒直到有完成事件
+	*/
+	int32_t enter(bool wait, uint32_t ms);
+	void arm(SOCKET_HANDLE fd);
+	void cancel(SOCKET_HANDLE fd);
+	int32_t modify(SOCKET_HANDLE fd, uint32_t sel_events);
+	void on_accept_cqe(SOCKET_HANDLE fd, int32_t res, uint32_t flags);
+	//关闭尚未取走的连接
+	void drop_accepted(FdSlot& s);
+	FdSlot* slot(SOCKET_HANDLE fd)
+	{
 		assert(fd != INVALID_SOCKET);
-		ev.events = EPOLLIN|EPOLLOUT;
-		ev.data.fd = fd;
-		return epoll_ctl(m_fd, EPOLL_CTL_MOD, fd, &ev);
+		if (static_cast<size_t>(fd) >= m_slots.size()) m_slots.resize(fd + 1);
+		return &m_slots[fd];
+	}
+public:
+	UringSelector();
+	~UringSelector();
+	UringSelector(const UringSelector&) = delete;
+	UringSelector& operator=(const UringSelector&) = delete;
+
+	/*
+	 @return io_uring是否可用，false表示已退化为EpollSelector
+	*/
+	bool uring_enabled() const { return m_fd != INVALID_SOCKET; }
+
+	/*
+	 @param ctx 事件就绪时传给poll()的NetConnect*，不能为空
+	*/
+	int32_t add(SOCKET_HANDLE fd, NetConnectState state, void* ctx);
+	int32_t del(SOCKET_HANDLE fd);
+	int32_t set_read_event(SOCKET_HANDLE fd)
+	{
+		return modify(fd, SELIN);
+	}
+	int32_t set_write_event(SOCKET_HANDLE fd)
+	{
+		return modify(fd, SELOUT);
+	}
+	int32_t set_read_write_event(SOCKET_HANDLE fd)
+	{
+		return modify(fd, SELIN | SELOUT);
 	}
 
+	/*
+	 注册线程唤醒fd，该fd可读时poll()提前返回
+	*/
+	int32_t set_notify_fd(SOCKET_HANDLE fd);
+
+	/*
+	 取出监听socket上multishot accept得到的一个连接
+	 @return 0成功；EAGAIN暂无连接；ENOTSUP该socket未使用multishot accept，需自行调用accept；
+	         其他为内核报告的accept错误
+	*/
+	int32_t accept(SOCKET_HANDLE listen_fd, SOCKET_HANDLE& fd);
+
+	/*
+	 @param ms 最长等待时间，UINT32_MAX表示一直等待
+	*/
+	int32_t poll(void* p_thread, uint32_t mode, uint32_t ms);
+};
+
+} //end of namespace asyncpp
+
+#endif
+
+#ifndef _DISABLE_POLL
+
+namespace asyncpp
+{
+
+/*
+ 基于poll(2)的selector，没有FD_SETSIZE的限制
+ pollfd数组常驻且紧凑排列，fd到数组下标的映射用按fd索引的vector，增删改均为O(1)
+ 删除时先把pollfd.fd置为-1(poll会忽略)，下次poll()前再与末尾交换后移除
+*/
+class PollSelector
+{
+private:
+	std::vector<struct pollfd> m_pfds;
+	std::vector<void*> m_ctxs; //与m_pfds一一对应
+	std::vector<uint32_t> m_events; //与m_pfds一一对应，关注的事件(SELIN/SELOUT)
+	std::vector<int32_t> m_index; //下标为fd，-1表示未注册
+	std::vector<int32_t> m_removed; //待移除的下标
+	SOCKET_HANDLE m_notify_fd;
+	uint32_t m_mode; //上次poll()的mode，变化时重新计算pollfd.events
+
+	static short to_poll_events(uint32_t sel_events)
+	{
+		return static_cast<short>((sel_events & SELIN ? POLLIN : 0) | (sel_events & SELOUT ? POLLOUT : 0));
+	}
+	int32_t find(SOCKET_HANDLE fd) const
+	{
+		assert(fd != INVALID_SOCKET);
+		return static_cast<size_t>(fd) < m_index.size() ? m_index[fd] : -1;
+	}
+	int32_t append(SOCKET_HANDLE fd, uint32_t sel_events, void* ctx)
+	{
+		if (static_cast<size_t>(fd) >= m_index.size()) m_index.resize(fd + 1, -1);
+		int32_t idx = static_cast<int32_t>(m_pfds.size());
+		struct pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = to_poll_events(sel_events & m_mode);
+		pfd.revents = 0;
+		m_pfds.push_back(pfd);
+		m_ctxs.push_back(ctx);
+		m_events.push_back(sel_events);
+		m_index[fd] = idx;
+		return idx;
+	}
+	int32_t modify(SOCKET_HANDLE fd, uint32_t sel_events)
+	{
+		int32_t idx = find(fd);
+		if (idx < 0)
+		{
+			errno = ENOENT;
+			return -1;
+		}
+		m_events[idx] = sel_events;
+		m_pfds[idx].events = to_poll_events(sel_events & m_mode);
+		return 0;
+	}
+	//移除已删除的pollfd，与末尾交换
+	void compact();
+public:
+	PollSelector()
+		: m_pfds()
+		, m_ctxs()
+		, m_events()
+		, m_index()
+		, m_removed()
+		, m_notify_fd(INVALID_SOCKET)
+		, m_mode(SELIN | SELOUT)
+	{
+	}
+	~PollSelector() = default;
+	PollSelector(const PollSelector&) = delete;
+	PollSelector& operator=(const PollSelector&) = delete;
+
+	/*
+	 @param ctx 事件就绪时传给poll()的NetConnect*，不能为空
+	*/
+	int32_t add(SOCKET_HANDLE fd, NetConnectState state, void* ctx)
+	{
+		assert(fd != INVALID_SOCKET);
+		assert(ctx != nullptr);
+		uint32_t events;
+		if (state == NetConnectState::NET_CONN_CONNECTED)
+		{
+			events = SELIN | SELOUT;
+		}
+		else if (state == NetConnectState::NET_CONN_LISTENING)
+		{
+			events = SELIN;
+		}
+		else if (state == NetConnectState::NET_CONN_CONNECTING)
+		{
+			events = SELOUT;
+		}
+		else
+		{
+			assert(0);
+			return EINVAL;
+		}
+		if (find(fd) >= 0)
+		{
+			//logger_warn(logger, "duplicate sockfd:%d", fd);
+			return -1;
+		}
+		append(fd, events, ctx);
+		return 0;
+	}
+	int32_t del(SOCKET_HANDLE fd)
+	{
+		int32_t idx = find(fd);
+		if (idx < 0)
+		{
+			errno = ENOENT;
+			return -1;
+		}
+		m_pfds[idx].fd = -1;
+		m_pfds[idx].revents = 0;
+		m_ctxs[idx] = nullptr;
+		m_index[fd] = -1;
+		m_removed.push_back(idx);
+		return 0;
+	}
+	int32_t set_read_event(SOCKET_HANDLE fd)
+	{
+		return modify(fd, SELIN);
+	}
+	int32_t set_write_event(SOCKET_HANDLE fd)
+	{
+		return modify(fd, SELOUT);
+	}
+	int32_t set_read_write_event(SOCKET_HANDLE fd)
+	{
+		return modify(fd, SELIN | SELOUT);
+	}
+
+	/*
+	 注册线程唤醒fd，该fd可读时poll()提前返回
+	*/
+	int32_t set_notify_fd(SOCKET_HANDLE fd)
+	{
+		if (find(fd) >= 0) return -1;
+		int32_t idx = append(fd, SELIN, nullptr);
+		m_pfds[idx].events = POLLIN;
+		m_notify_fd = fd;
+		return 0;
+	}
+
+	/*
+	 @param ms 最长等待时间，UINT32_MAX表示一直等待
+	*/
 	int32_t poll(void* p_thread, uint32_t mode, uint32_t ms);
 };
 
@@ -179,6 +674,13 @@ public:
 
 #define GET_SOCK_ERR() WSAGetLastError()
 
+/* windows has no struct iovec */
+struct iovec
+{
+	void* iov_base;
+	size_t iov_len;
+};
+
 /* windows xp has no inet_ntop
 	@return dst on success
 	        nullptr on error
@@ -257,13 +759,14 @@ private:
 	//HANDLE m_fd; //not need
 	std::unordered_map<SOCKET_HANDLE, uint32_t> m_fds;
 	std::vector<SOCKET_HANDLE> m_removed_fds;
+	SOCKET_HANDLE m_notify_fd;
 public:
-	SelSelector() = default;
+	SelSelector() : m_fds(), m_removed_fds(), m_notify_fd(INVALID_SOCKET) {}
 	~SelSelector() = default;
 	SelSelector(const SelSelector&) = delete;
 	SelSelector& operator=(const SelSelector&) = delete;
 
-	int32_t add(SOCKET_HANDLE fd, NetConnectState state)
+	int32_t add(SOCKET_HANDLE fd, NetConnectState state, void* ctx)
 	{
 		assert(fd != INVALID_SOCKET);
 		auto it = m_fds.find(fd);
@@ -325,6 +828,23 @@ public:
 		return 0;
 	}
 
+	/*
+	 注册线程唤醒fd，该fd可读时poll()提前返回
+	*/
+	int32_t set_notify_fd(SOCKET_HANDLE fd)
+	{
+#ifdef _WIN32
+		return -1; //select only support socket
+#else
+		if (fd >= FD_SETSIZE) return -1;
+		m_notify_fd = fd;
+		return 0;
+#endif
+	}
+
+	/*
+	 @param ms 最长等待时间，UINT32_MAX表示一直等待
+	*/
 	int32_t poll(void* p_thread, uint32_t mode, uint32_t ms);
 };
 
@@ -2,27 +2,162 @@
 #define _SPINLOCK_HPP_
 
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 
 #ifdef _WIN32
 #include <Winsock2.h> //include before windows.h
 #include <Windows.h>
 #else
 #include <unistd.h>
+#include <sched.h>
+#endif
+
+#ifdef __linux__
+#include <climits>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+//pause iterations before a waiter parks
+#ifndef _ASYNCPP_SPINLOCK_SPIN_LIMIT
+#define _ASYNCPP_SPINLOCK_SPIN_LIMIT 256
 #endif
 
 namespace asyncpp
 {
 
-class SpinLock
+inline void cpu_relax()
+{
+#if defined(_WIN32)
+	YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+//block the caller while *addr == val, may return spuriously
+inline void lock_park(std::atomic<uint32_t>* addr, uint32_t val)
 {
+#ifdef __linux__
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr),
+		FUTEX_WAIT_PRIVATE, val, nullptr, nullptr, 0);
+#elif defined(_WIN32)
+	(void)addr; (void)val;
+	SwitchToThread();
+#else
+	(void)addr; (void)val;
+	sched_yield();
+#endif
+}
+
+inline void lock_unpark(std::atomic<uint32_t>* addr, int n)
+{
+#ifdef __linux__
+	syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr),
+		FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+#else
+	(void)addr; (void)n;
+#endif
+}
+
+struct SpinLockStats
+{
+	uint64_t acquisitions; //successful lock() and trySpinLock()
+	uint64_t spins; //pause iterations while waiting
+	uint64_t parks; //times a waiter went to sleep
+	uint64_t wait_ns; //total time spent waiting in contended lock()
+};
+
+/*
+ Contention counters of a lock.
+ Only the lock holder writes them, so no read-modify-write is needed;
+ readers on other threads get a slightly stale but consistent-enough view.
+ Define _ASYNCPP_SPINLOCK_NO_STATS to compile them out.
+*/
+class SpinLockCounters
+{
+private:
+#ifndef _ASYNCPP_SPINLOCK_NO_STATS
+	std::atomic<uint64_t> m_acquisitions;
+	std::atomic<uint64_t> m_spins;
+	std::atomic<uint64_t> m_parks;
+	std::atomic<uint64_t> m_wait_ns;
+
+	static void add(std::atomic<uint64_t>& c, uint64_t n)
+	{
+		c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+#endif
 public:
-	SpinLock() : m_lock()
+	SpinLockCounters()
+#ifndef _ASYNCPP_SPINLOCK_NO_STATS
+		: m_acquisitions(0), m_spins(0), m_parks(0), m_wait_ns(0)
+#endif
 	{
-#ifdef _WIN32
-		//vc bug
-		m_lock._My_flag = 0;
+	}
+
+	//call with the lock held
+	void on_acquire()
+	{
+#ifndef _ASYNCPP_SPINLOCK_NO_STATS
+		add(m_acquisitions, 1);
+#endif
+	}
+	//call with the lock held
+	void on_contended(uint32_t spins, uint32_t parks,
+		std::chrono::steady_clock::time_point start)
+	{
+#ifndef _ASYNCPP_SPINLOCK_NO_STATS
+		add(m_spins, spins);
+		add(m_parks, parks);
+		add(m_wait_ns, static_cast<uint64_t>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - start).count()));
+#else
+		(void)spins; (void)parks; (void)start;
+#endif
+	}
+
+	SpinLockStats get() const
+	{
+		SpinLockStats s = {};
+#ifndef _ASYNCPP_SPINLOCK_NO_STATS
+		s.acquisitions = m_acquisitions.load(std::memory_order_relaxed);
+		s.spins = m_spins.load(std::memory_order_relaxed);
+		s.parks = m_parks.load(std::memory_order_relaxed);
+		s.wait_ns = m_wait_ns.load(std::memory_order_relaxed);
+#endif
+		return s;
+	}
+	void reset()
+	{
+#ifndef _ASYNCPP_SPINLOCK_NO_STATS
+		m_acquisitions.store(0, std::memory_order_relaxed);
+		m_spins.store(0, std::memory_order_relaxed);
+		m_parks.store(0, std::memory_order_relaxed);
+		m_wait_ns.store(0, std::memory_order_relaxed);
 #endif
 	}
+};
+
+/*
+ Test-and-test-and-set lock.
+ Waiters spin on a plain load with a pause instruction for a bounded
+ number of iterations, then park on a futex until the holder releases.
+*/
+class SpinLock
+{
+private:
+	enum : uint32_t { UNLOCKED, LOCKED, CONTENDED };
+	std::atomic<uint32_t> m_lock;
+	SpinLockCounters m_stats;
+public:
+	SpinLock() : m_lock(UNLOCKED), m_stats()
+	{
+	}
 	~SpinLock()
 	{
 	}
@@ -32,52 +167,184 @@ public:
 	//block until obtain the lock
 	void lock()
 	{
-		while (m_lock.test_and_set())
+		uint32_t c = UNLOCKED;
+		if (!m_lock.compare_exchange_strong(c, LOCKED, std::memory_order_acquire))
 		{
-#ifdef _WIN32
-			Sleep(1);
-#else
-			usleep(1);
-#endif
+			lock_contended();
+		}
+		m_stats.on_acquire();
+	}
+
+	//return true if success to get the lock, false if failed
+	bool trySpinLock()
+	{
+		uint32_t c = UNLOCKED;
+		if (m_lock.load(std::memory_order_relaxed) == UNLOCKED
+			&& m_lock.compare_exchange_strong(c, LOCKED, std::memory_order_acquire))
+		{
+			m_stats.on_acquire();
+			return true;
+		}
+		return false;
+	}
+
+	void unlock()
+	{
+		if (m_lock.exchange(UNLOCKED, std::memory_order_release) == CONTENDED)
+		{
+			lock_unpark(&m_lock, 1);
 		}
 	}
 
+	SpinLockStats get_stats() const { return m_stats.get(); }
+	void reset_stats() { m_stats.reset(); }
+
+private:
+	void lock_contended()
+	{
+		auto start = std::chrono::steady_clock::now();
+		uint32_t spins = 0;
+		uint32_t parks = 0;
+		uint32_t c;
+
+		for (; spins < _ASYNCPP_SPINLOCK_SPIN_LIMIT; ++spins)
+		{
+			c = m_lock.load(std::memory_order_relaxed);
+			if (c == UNLOCKED && m_lock.compare_exchange_weak(c, LOCKED,
+				std::memory_order_acquire))
+			{
+				m_stats.on_contended(spins, parks, start);
+				return;
+			}
+			cpu_relax();
+		}
+
+		//mark the lock contended so unlock() knows someone may sleep
+		while (m_lock.exchange(CONTENDED, std::memory_order_acquire) != UNLOCKED)
+		{
+			++parks;
+			lock_park(&m_lock, CONTENDED);
+		}
+		m_stats.on_contended(spins, parks, start);
+	}
+};
+
+/*
+ Fair (FIFO) ticket lock with the same spin-then-park behaviour.
+ Waiters are served strictly in arrival order, at the cost of
+ waking every parked waiter on each hand-over.
+*/
+class FairSpinLock
+{
+private:
+	std::atomic<uint32_t> m_next;
+	std::atomic<uint32_t> m_serving;
+	std::atomic<uint32_t> m_parked;
+	SpinLockCounters m_stats;
+public:
+	FairSpinLock() : m_next(0), m_serving(0), m_parked(0), m_stats()
+	{
+	}
+	~FairSpinLock()
+	{
+	}
+	FairSpinLock(const FairSpinLock& r) = delete;
+	FairSpinLock& operator=(const FairSpinLock& r) = delete;
+public:
+	//block until obtain the lock
+	void lock()
+	{
+		uint32_t ticket = m_next.fetch_add(1, std::memory_order_relaxed);
+		if (m_serving.load(std::memory_order_acquire) != ticket)
+		{
+			lock_contended(ticket);
+		}
+		m_stats.on_acquire();
+	}
+
 	//return true if success to get the lock, false if failed
 	bool trySpinLock()
 	{
-		return !m_lock.test_and_set();
+		uint32_t serving = m_serving.load(std::memory_order_acquire);
+		uint32_t ticket = serving;
+		if (m_next.compare_exchange_strong(ticket, serving + 1,
+			std::memory_order_acquire))
+		{
+			m_stats.on_acquire();
+			return true;
+		}
+		return false;
 	}
 
 	void unlock()
 	{
-		m_lock.clear();
+		m_serving.store(m_serving.load(std::memory_order_relaxed) + 1,
+			std::memory_order_seq_cst);
+		if (m_parked.load(std::memory_order_seq_cst) != 0)
+		{
+			lock_unpark(&m_serving, INT32_MAX);
+		}
 	}
+
+	SpinLockStats get_stats() const { return m_stats.get(); }
+	void reset_stats() { m_stats.reset(); }
+
 private:
-	volatile std::atomic_flag m_lock;
+	void lock_contended(uint32_t ticket)
+	{
+		auto start = std::chrono::steady_clock::now();
+		uint32_t spins = 0;
+		uint32_t parks = 0;
+		uint32_t serving;
+
+		for (; spins < _ASYNCPP_SPINLOCK_SPIN_LIMIT; ++spins)
+		{
+			if (m_serving.load(std::memory_order_acquire) == ticket)
+			{
+				m_stats.on_contended(spins, parks, start);
+				return;
+			}
+			cpu_relax();
+		}
+
+		m_parked.fetch_add(1, std::memory_order_seq_cst);
+		while ((serving = m_serving.load(std::memory_order_seq_cst)) != ticket)
+		{
+			++parks;
+			lock_park(&m_serving, serving);
+		}
+		m_parked.fetch_sub(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		m_stats.on_contended(spins, parks, start);
+	}
 };
 
-class ScopeSpinLock{
+template<typename Lock>
+class ScopeLock{
 public:
-	ScopeSpinLock(SpinLock& lock)
+	ScopeLock(Lock& lock)
 		: m_plock(&lock)
 	{
 		m_plock->lock();
 	}
-	ScopeSpinLock(SpinLock* plock)
+	ScopeLock(Lock* plock)
 		: m_plock(plock)
 	{
 		m_plock->lock();
 	}
-	~ScopeSpinLock()
+	~ScopeLock()
 	{
 		m_plock->unlock();
 	}
-	ScopeSpinLock(const ScopeSpinLock&) = delete;
-	ScopeSpinLock& operator=(const ScopeSpinLock& r) = delete;
+	ScopeLock(const ScopeLock&) = delete;
+	ScopeLock& operator=(const ScopeLock& r) = delete;
 private:
-	SpinLock* m_plock;
+	Lock* m_plock;
 };
 
+typedef ScopeLock<SpinLock> ScopeSpinLock;
+typedef ScopeLock<FairSpinLock> ScopeFairSpinLock;
+
 } //end of namespace asyncpp
 
 #endif
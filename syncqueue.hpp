@@ -2,6 +2,8 @@
 #define _SYNCQUEUE_HPP_
 
 #include <mutex>
+#include <atomic>
+#include <vector>
 #include <cstdint>
 #include "spinlock.hpp"
 
@@ -9,46 +11,312 @@
 #pragma warning(disable:4351) //for visual studio
 #endif
 
+#ifndef _ASYNCPP_CACHELINE_SIZE
+#define _ASYNCPP_CACHELINE_SIZE 64
+#endif
+
+#ifndef _ASYNCPP_QUEUE_SEGMENT_SIZE
+#define _ASYNCPP_QUEUE_SEGMENT_SIZE 64
+#endif
+
+#ifndef _ASYNCPP_QUEUE_SEGMENT_POOL_LIMIT
+#define _ASYNCPP_QUEUE_SEGMENT_POOL_LIMIT 256
+#endif
+
 namespace asyncpp
 {
 
 //typedef std::mutex SyncQueueMutex;
 //typedef std::lock_guard<std::mutex> SyncQueueScopeLock;
+#ifdef _ASYNCPP_SYNCQUEUE_FAIR_LOCK
+typedef FairSpinLock SyncQueueMutex;
+typedef ScopeFairSpinLock SyncQueueScopeLock;
+#else
 typedef SpinLock SyncQueueMutex;
 typedef ScopeSpinLock SyncQueueScopeLock;
+#endif
 
-//最多容纳N-1个数据，本对象会占用 N*sizeof(T) 的内存空间
+/*
+ 溢出段池，为各队列的溢出链提供固定大小的段，段归还后被缓存复用
+ 每种T共用一个池，最多缓存_ASYNCPP_QUEUE_SEGMENT_POOL_LIMIT个空闲段
+*/
+template<typename T>
+class QueueSegmentPool
+{
+public:
+	struct Segment
+	{
+		Segment* next;
+		uint32_t head;
+		uint32_t tail;
+		T data[_ASYNCPP_QUEUE_SEGMENT_SIZE];
+
+		Segment() : next(nullptr), head(0), tail(0), data() {}
+	};
+private:
+	SpinLock m_lock;
+	Segment* m_free;
+	uint32_t m_free_cnt;
+	std::atomic<uint32_t> m_used_cnt;
+
+	QueueSegmentPool() : m_lock(), m_free(nullptr), m_free_cnt(0), m_used_cnt(0) {}
+public:
+	~QueueSegmentPool()
+	{
+		while (m_free != nullptr)
+		{
+			Segment* seg = m_free;
+			m_free = seg->next;
+			delete seg;
+		}
+	}
+	QueueSegmentPool(const QueueSegmentPool&) = delete;
+	QueueSegmentPool& operator=(const QueueSegmentPool&) = delete;
+
+	static QueueSegmentPool& instance()
+	{
+		static QueueSegmentPool pool;
+		return pool;
+	}
+
+	Segment* alloc()
+	{
+		Segment* seg = nullptr;
+		{
+			ScopeSpinLock lock(m_lock);
+			if (m_free != nullptr)
+			{
+				seg = m_free;
+				m_free = seg->next;
+				--m_free_cnt;
+			}
+		}
+		if (seg == nullptr) seg = new Segment();
+		seg->next = nullptr;
+		seg->head = 0;
+		seg->tail = 0;
+		m_used_cnt.fetch_add(1, std::memory_order_relaxed);
+		return seg;
+	}
+	//段内元素必须已被移走
+	void free(Segment* seg)
+	{
+		m_used_cnt.fetch_sub(1, std::memory_order_relaxed);
+		{
+			ScopeSpinLock lock(m_lock);
+			if (m_free_cnt < _ASYNCPP_QUEUE_SEGMENT_POOL_LIMIT)
+			{
+				seg->next = m_free;
+				m_free = seg;
+				++m_free_cnt;
+				return;
+			}
+		}
+		delete seg;
+	}
+
+	uint32_t used() const { return m_used_cnt.load(std::memory_order_relaxed); }
+	uint32_t cached() const { return m_free_cnt; }
+};
+
+/*
+ 队列满时的溢出链，由若干从QueueSegmentPool借来的段组成，段取空后立即归还
+ 线程安全，但不应在持有本链的回调中再次访问本链
+*/
+template<typename T>
+class QueueOverflowChain
+{
+private:
+	typedef typename QueueSegmentPool<T>::Segment Segment;
+	SpinLock m_lock;
+	Segment* m_head;
+	Segment* m_tail;
+	std::atomic<uint32_t> m_size;
+public:
+	QueueOverflowChain() : m_lock(), m_head(nullptr), m_tail(nullptr), m_size(0) {}
+	~QueueOverflowChain()
+	{
+		T val;
+		while (pop(std::move(val)));
+	}
+	QueueOverflowChain(const QueueOverflowChain&) = delete;
+	QueueOverflowChain& operator=(const QueueOverflowChain&) = delete;
+
+	uint32_t size() const { return m_size.load(std::memory_order_acquire); }
+	bool empty() const { return size() == 0; }
+
+	bool push(T&& val)
+	{
+		ScopeSpinLock lock(m_lock);
+		if (m_tail == nullptr || m_tail->tail == _ASYNCPP_QUEUE_SEGMENT_SIZE)
+		{
+			Segment* seg = QueueSegmentPool<T>::instance().alloc();
+			if (m_tail != nullptr) m_tail->next = seg;
+			else m_head = seg;
+			m_tail = seg;
+		}
+		m_tail->data[m_tail->tail++] = std::move(val);
+		m_size.fetch_add(1, std::memory_order_release);
+		return true;
+	}
+	bool pop(T&& val)
+	{
+		ScopeSpinLock lock(m_lock);
+		if (m_head == nullptr || m_head->head == m_head->tail) return false;
+		val = std::move(m_head->data[m_head->head++]);
+		m_size.fetch_sub(1, std::memory_order_relaxed);
+		if (m_head->head == m_head->tail)
+		{
+			Segment* seg = m_head;
+			m_head = seg->next;
+			if (m_head == nullptr) m_tail = nullptr;
+			QueueSegmentPool<T>::instance().free(seg);
+		}
+		return true;
+	}
+
+	/*遍历全部元素,返回删除的元素个数*/
+	int32_t traverse(int32_t(*callback)(T&, void*), void* arg)
+	{
+		ScopeSpinLock lock(m_lock);
+		Segment* dst = m_head;
+		uint32_t dst_pos = dst != nullptr ? dst->head : 0;
+		int32_t cnt = 0;
+
+		for (Segment* seg = m_head; seg != nullptr; seg = seg->next)
+		{
+			for (uint32_t pos = seg->head; pos < seg->tail; ++pos)
+			{
+				if (callback(seg->data[pos], arg) != 0)
+				{
+					seg->data[pos] = T();
+					++cnt;
+					continue;
+				}
+				if (dst_pos == _ASYNCPP_QUEUE_SEGMENT_SIZE)
+				{
+					dst = dst->next;
+					dst_pos = 0;
+				}
+				if (dst != seg || dst_pos != pos)
+				{
+					dst->data[dst_pos] = std::move(seg->data[pos]);
+				}
+				++dst_pos;
+			}
+		}
+		if (cnt == 0) return 0;
+
+		//归还压缩后多余的段
+		if (dst != nullptr && dst_pos == dst->head)
+		{ //全部删除
+			dst = nullptr;
+		}
+		Segment* seg = dst != nullptr ? dst->next : m_head;
+		if (dst != nullptr)
+		{
+			dst->tail = dst_pos;
+			dst->next = nullptr;
+		}
+		else m_head = nullptr;
+		m_tail = dst;
+		while (seg != nullptr)
+		{
+			Segment* next = seg->next;
+			QueueSegmentPool<T>::instance().free(seg);
+			seg = next;
+		}
+		m_size.fetch_sub(cnt, std::memory_order_relaxed);
+		return cnt;
+	}
+};
+
+/*
+ 基于自旋锁的环形队列，最多容纳capacity个数据，本对象会占用 (capacity+1)*sizeof(T) 的内存空间
+ 默认capacity为N-1，可通过resize()在使用前调整
+ 开启溢出模式后，队列满时数据被存入溢出链，不会丢失
+*/
 template<typename T, std::size_t N = 128>
 class FixedSizeCircleQueue
 {
 private:
 	SyncQueueMutex mtx;
-	T queue_data[N];
+	T* queue_data;
+	uint32_t slots;
 	uint32_t front_pos;
 	uint32_t after_back_pos;
+	QueueOverflowChain<T>* overflow;
+
+	uint32_t prev(uint32_t pos) const { return pos != 0 ? pos - 1 : slots - 1; }
 public:
-	FixedSizeCircleQueue() :mtx(), queue_data(), front_pos(N - 1), after_back_pos(N - 1){}
-	~FixedSizeCircleQueue() = default;
+	explicit FixedSizeCircleQueue(uint32_t capacity = N - 1)
+		: mtx()
+		, queue_data(new T[capacity + 1])
+		, slots(capacity + 1)
+		, front_pos(capacity)
+		, after_back_pos(capacity)
+		, overflow(nullptr)
+	{}
+	~FixedSizeCircleQueue()
+	{
+		delete[] queue_data;
+		delete overflow;
+	}
 	FixedSizeCircleQueue(const FixedSizeCircleQueue&) = delete;
 	FixedSizeCircleQueue& operator=(const FixedSizeCircleQueue&) = delete;
 
-	uint32_t size() const { return front_pos >= after_back_pos ? front_pos - after_back_pos : N - (after_back_pos - front_pos); }
+	/*
+	 调整容量并设置溢出模式，队列中的数据会被丢弃
+	 非线程安全，应当在队列投入使用前调用
+	*/
+	void resize(uint32_t capacity, bool enable_overflow = false)
+	{
+		if (capacity == 0) capacity = 1;
+		if (capacity + 1 != slots)
+		{
+			delete[] queue_data;
+			queue_data = new T[capacity + 1];
+			slots = capacity + 1;
+		}
+		front_pos = after_back_pos = slots - 1;
+		delete overflow;
+		overflow = enable_overflow ? new QueueOverflowChain<T>() : nullptr;
+	}
+	uint32_t capacity() const { return slots - 1; }
+	bool overflow_enabled() const { return overflow != nullptr; }
+
+	uint32_t size() const
+	{
+		uint32_t n = front_pos >= after_back_pos ? front_pos - after_back_pos : slots - (after_back_pos - front_pos);
+		return overflow != nullptr ? n + overflow->size() : n;
+	}
 	uint32_t size_safe(){ SyncQueueScopeLock lock(mtx); return size(); }
-	bool empty() const { return front_pos == after_back_pos; }
+	bool empty() const { return front_pos == after_back_pos && (overflow == nullptr || overflow->empty()); }
 	bool empty_safe(){ SyncQueueScopeLock lock(mtx); return empty(); }
-	bool full() const { return after_back_pos != 0 ? after_back_pos - 1 == front_pos : N - 1 == front_pos; }
+	bool full() const { return overflow == nullptr && prev(after_back_pos) == front_pos; }
 	bool full_safe(){ SyncQueueScopeLock lock(mtx); return full(); }
 
+	//用于读取锁的竞争统计
+	const SyncQueueMutex& mutex() const { return mtx; }
+
 	bool push(T&& val)
 	{
 		SyncQueueScopeLock lock(mtx);
-		uint32_t new_pos = after_back_pos != 0 ? after_back_pos - 1 : N - 1;
-		if (new_pos != front_pos)
+		uint32_t new_pos = prev(after_back_pos);
+		if (overflow != nullptr && !overflow->empty())
+		{ //保持先进先出，溢出链非空时继续写入溢出链
+			return overflow->push(std::move(val));
+		}
+		else if (new_pos != front_pos)
 		{
 			queue_data[after_back_pos] = std::move(val);
 			after_back_pos = new_pos;
 			return true;
 		}
+		else if (overflow != nullptr)
+		{
+			return overflow->push(std::move(val));
+		}
 		else return false;
 	}
 	bool pop(T&& val)
@@ -57,10 +325,14 @@ public:
 		if (front_pos != after_back_pos)
 		{
 			uint32_t pos = front_pos;
-			front_pos = pos != 0 ? pos - 1 : N - 1;
+			front_pos = prev(pos);
 			val = std::move(queue_data[pos]);
 			return true;
 		}
+		else if (overflow != nullptr)
+		{
+			return overflow->pop(std::move(val));
+		}
 		else return false;
 	}
 	uint32_t pop(T* val, uint32_t n)
@@ -70,9 +342,13 @@ public:
 		while (front_pos != after_back_pos && cnt < n)
 		{
 			uint32_t pos = front_pos;
-			front_pos = pos != 0 ? pos - 1 : N - 1;
+			front_pos = prev(pos);
 			val[cnt++] = std::move(queue_data[pos]);
-		} 
+		}
+		if (overflow != nullptr)
+		{
+			while (cnt < n && overflow->pop(std::move(val[cnt]))) ++cnt;
+		}
 		return cnt;
 	}
 	T&& pop()
@@ -81,7 +357,7 @@ public:
 		if (front_pos != after_back_pos)
 		{
 			uint32_t pos = front_pos;
-			front_pos = pos != 0 ? pos - 1 : N - 1;
+			front_pos = prev(pos);
 			return std::move(queue_data[pos]);
 		}
 		else return std::move(T());
@@ -110,7 +386,7 @@ public:
 
 		for (new_back_pos = front_pos;
 			new_back_pos != after_back_pos;
-			new_back_pos = new_back_pos != 0 ? new_back_pos - 1 : N - 1)
+			new_back_pos = prev(new_back_pos))
 		{
 			ret = callback(queue_data[new_back_pos], arg);
 			if (ret != 0)
@@ -120,12 +396,12 @@ public:
 				else goto L_END;
 			}
 		}
-		return 0;
+		goto L_OVERFLOW;
 
 	L_RM_ELEMENT:
-		for (pos = new_back_pos != 0 ? new_back_pos - 1 : N - 1;
+		for (pos = prev(new_back_pos);
 			pos != after_back_pos;
-			pos = pos != 0 ? pos - 1 : N - 1)
+			pos = prev(pos))
 		{
 			ret = callback(queue_data[pos], arg);
 			if (ret != 0)
@@ -135,12 +411,375 @@ public:
 			else
 			{
 				queue_data[new_back_pos] = std::move(queue_data[pos]);
-				new_back_pos = new_back_pos != 0 ? new_back_pos - 1 : N - 1;
+				new_back_pos = prev(new_back_pos);
 			}
 		}
 
 	L_END:
 		after_back_pos = new_back_pos;
+	L_OVERFLOW:
+		if (overflow != nullptr) cnt += overflow->traverse(callback, arg);
+		return cnt;
+	}
+};
+
+/*
+ 无锁多生产者单消费者有界队列，容量为N(可通过resize()在使用前调整)，容量必须为2的幂
+ 每个槽位带有序号，生产者通过CAS争抢写入位置，消费者无需任何原子读改写操作
+ 开启溢出模式后，队列满时数据被存入溢出链，不会丢失
+ push/size/full/empty可在任意线程调用
+ pop/consume/traverse只能在唯一的消费者线程调用
+*/
+template<typename T, std::size_t N = 128>
+class MpscBoundedQueue
+{
+private:
+	struct Cell
+	{
+		std::atomic<uint32_t> seq;
+		T data;
+	};
+
+	//head/tail分别独占缓存行，避免生产者与消费者间的伪共享
+	char pad0[_ASYNCPP_CACHELINE_SIZE];
+	std::atomic<uint32_t> enqueue_pos;
+	char pad1[_ASYNCPP_CACHELINE_SIZE - sizeof(std::atomic<uint32_t>)];
+	std::atomic<uint32_t> dequeue_pos;
+	char pad2[_ASYNCPP_CACHELINE_SIZE - sizeof(std::atomic<uint32_t>)];
+	Cell* cells;
+	uint32_t mask;
+	QueueOverflowChain<T>* overflow;
+
+	void init_cells(uint32_t n)
+	{
+		cells = new Cell[n];
+		mask = n - 1;
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			cells[i].seq.store(i, std::memory_order_relaxed);
+		}
+		enqueue_pos.store(0, std::memory_order_relaxed);
+		dequeue_pos.store(0, std::memory_order_relaxed);
+	}
+	bool ring_push(T&& val)
+	{
+		Cell* c;
+		uint32_t pos = enqueue_pos.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			c = &cells[pos & mask];
+			uint32_t seq = c->seq.load(std::memory_order_acquire);
+			int32_t dif = static_cast<int32_t>(seq - pos);
+			if (dif == 0)
+			{
+				if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+					std::memory_order_relaxed)) break;
+			}
+			else if (dif < 0) return false; //full
+			else pos = enqueue_pos.load(std::memory_order_relaxed);
+		}
+		c->data = std::move(val);
+		c->seq.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+	uint32_t ring_size() const
+	{
+		uint32_t n = enqueue_pos.load(std::memory_order_relaxed)
+			- dequeue_pos.load(std::memory_order_relaxed);
+		return n <= mask + 1 ? n : mask + 1;
+	}
+	bool ring_empty() const
+	{
+		uint32_t pos = dequeue_pos.load(std::memory_order_relaxed);
+		const Cell& c = cells[pos & mask];
+		return c.seq.load(std::memory_order_acquire) != pos + 1;
+	}
+public:
+	explicit MpscBoundedQueue(uint32_t capacity = N)
+		: enqueue_pos(0), dequeue_pos(0), cells(nullptr), mask(0), overflow(nullptr)
+	{
+		init_cells(round_capacity(capacity));
+	}
+	~MpscBoundedQueue()
+	{
+		delete[] cells;
+		delete overflow;
+	}
+	MpscBoundedQueue(const MpscBoundedQueue&) = delete;
+	MpscBoundedQueue& operator=(const MpscBoundedQueue&) = delete;
+
+	static uint32_t round_capacity(uint32_t capacity)
+	{
+		uint32_t n = 2;
+		while (n < capacity) n <<= 1;
+		return n;
+	}
+
+	/*
+	 调整容量(向上取整为2的幂)并设置溢出模式，队列中的数据会被丢弃
+	 非线程安全，应当在队列投入使用前调用
+	*/
+	void resize(uint32_t capacity, bool enable_overflow = false)
+	{
+		uint32_t n = round_capacity(capacity);
+		if (n != mask + 1)
+		{
+			delete[] cells;
+			init_cells(n);
+		}
+		else
+		{
+			T val;
+			while (pop(std::move(val)));
+		}
+		delete overflow;
+		overflow = enable_overflow ? new QueueOverflowChain<T>() : nullptr;
+	}
+	uint32_t capacity() const { return mask + 1; }
+	bool overflow_enabled() const { return overflow != nullptr; }
+
+	uint32_t size() const
+	{
+		return overflow != nullptr ? ring_size() + overflow->size() : ring_size();
+	}
+	uint32_t size_safe() const { return size(); }
+	bool empty() const
+	{
+		return ring_empty() && (overflow == nullptr || overflow->empty());
+	}
+	bool empty_safe() const { return empty(); }
+	bool full() const { return overflow == nullptr && ring_size() > mask; }
+	bool full_safe() const { return full(); }
+
+	bool push(T&& val)
+	{
+		if (overflow == nullptr) return ring_push(std::move(val));
+		//溢出链非空时继续写入溢出链，保证同一生产者的数据先进先出
+		if (overflow->empty() && ring_push(std::move(val))) return true;
+		return overflow->push(std::move(val));
+	}
+	bool pop(T&& val)
+	{
+		uint32_t pos = dequeue_pos.load(std::memory_order_relaxed);
+		Cell& c = cells[pos & mask];
+		if (c.seq.load(std::memory_order_acquire) != pos + 1)
+		{
+			return overflow != nullptr && overflow->pop(std::move(val));
+		}
+		val = std::move(c.data);
+		c.seq.store(pos + mask + 1, std::memory_order_release);
+		dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+		return true;
+	}
+	uint32_t pop(T* val, uint32_t n)
+	{
+		uint32_t cnt = 0;
+		while (cnt < n && pop(std::move(val[cnt]))) ++cnt;
+		return cnt;
+	}
+
+	/*
+	 在队列内原地处理至多n个元素，不产生额外的移动
+	 f(T&)返回后元素被重置为T()并归还槽位
+	 f内可以向本队列push
+	*/
+	template<typename F>
+	uint32_t consume(F&& f, uint32_t n)
+	{
+		uint32_t cnt = 0;
+		uint32_t pos = dequeue_pos.load(std::memory_order_relaxed);
+		while (cnt < n)
+		{
+			Cell& c = cells[pos & mask];
+			if (c.seq.load(std::memory_order_acquire) != pos + 1) break;
+			f(c.data);
+			c.data = T();
+			c.seq.store(pos + mask + 1, std::memory_order_release);
+			dequeue_pos.store(++pos, std::memory_order_relaxed);
+			++cnt;
+		}
+		if (overflow != nullptr && cnt < n)
+		{ //溢出链中的数据需先取出，避免在持有链锁时回调
+			T val;
+			while (cnt < n && overflow->pop(std::move(val)))
+			{
+				f(val);
+				val = T();
+				++cnt;
+			}
+		}
+		return cnt;
+	}
+
+	/*遍历已写入的元素,返回删除的元素个数，只能在消费者线程调用
+	int32_t callback(T& v, void*);
+	return 0 -> ignore
+	       1 -> remove the element
+	*/
+	int32_t traverse(int32_t(*callback)(T&, void*), void* arg)
+	{
+		uint32_t front = dequeue_pos.load(std::memory_order_relaxed);
+		uint32_t back = front;
+		std::vector<bool> removed;
+		int32_t cnt = 0;
+
+		for (; back - front <= mask; ++back)
+		{
+			Cell& c = cells[back & mask];
+			if (c.seq.load(std::memory_order_acquire) != back + 1) break;
+			bool rm = callback(c.data, arg) != 0;
+			removed.push_back(rm);
+			if (rm) ++cnt;
+		}
+
+		if (cnt != 0)
+		{
+			//保留的元素向队尾方向压缩，队首空出的槽位依次归还
+			uint32_t dst = back;
+			for (uint32_t pos = back; pos != front; --pos)
+			{
+				Cell& c = cells[(pos - 1) & mask];
+				if (removed[pos - 1 - front])
+				{
+					c.data = T();
+				}
+				else if (--dst != pos - 1)
+				{
+					cells[dst & mask].data = std::move(c.data);
+				}
+			}
+			for (uint32_t pos = front; pos != dst; ++pos)
+			{
+				cells[pos & mask].seq.store(pos + mask + 1, std::memory_order_release);
+			}
+			dequeue_pos.store(dst, std::memory_order_relaxed);
+		}
+		if (overflow != nullptr) cnt += overflow->traverse(callback, arg);
+		return cnt;
+	}
+};
+
+/*
+ Chase-Lev风格的工作窃取双端队列，容量为N(可通过resize()在使用前调整)，容量必须为2的幂
+ 所有者线程在底部push，所有者pop和其它线程steal都从顶部按放入顺序取出(先进先出)
+ 每个槽位带有序号，窃取者只有在CAS赢得位置后才移动数据，T可以是持有资源的类型
+ push/pop只能在所有者线程调用，steal/size/empty可在任意线程调用
+*/
+template<typename T, std::size_t N = 256>
+class WorkStealingDeque
+{
+private:
+	struct Cell
+	{
+		std::atomic<uint32_t> seq; //等于位置号表示该位置可写入
+		T data;
+	};
+
+	//top由窃取者修改，bottom由所有者修改，分别独占缓存行
+	char pad0[_ASYNCPP_CACHELINE_SIZE];
+	std::atomic<uint32_t> top;
+	char pad1[_ASYNCPP_CACHELINE_SIZE - sizeof(std::atomic<uint32_t>)];
+	std::atomic<uint32_t> bottom;
+	char pad2[_ASYNCPP_CACHELINE_SIZE - sizeof(std::atomic<uint32_t>)];
+	Cell* cells;
+	uint32_t mask;
+
+	void init_cells(uint32_t n)
+	{
+		cells = new Cell[n];
+		mask = n - 1;
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			cells[i].seq.store(i, std::memory_order_relaxed);
+		}
+		top.store(0, std::memory_order_relaxed);
+		bottom.store(0, std::memory_order_relaxed);
+	}
+public:
+	explicit WorkStealingDeque(uint32_t capacity = N)
+		: top(0), bottom(0), cells(nullptr), mask(0)
+	{
+		init_cells(MpscBoundedQueue<T, N>::round_capacity(capacity));
+	}
+	~WorkStealingDeque() { delete[] cells; }
+	WorkStealingDeque(const WorkStealingDeque&) = delete;
+	WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+	/*
+	 调整容量(向上取整为2的幂)，队列中的数据会被丢弃
+	 非线程安全，应当在队列投入使用前调用
+	*/
+	void resize(uint32_t capacity)
+	{
+		delete[] cells;
+		init_cells(MpscBoundedQueue<T, N>::round_capacity(capacity));
+	}
+	uint32_t capacity() const { return mask + 1; }
+
+	uint32_t size() const
+	{
+		int32_t n = static_cast<int32_t>(bottom.load(std::memory_order_relaxed)
+			- top.load(std::memory_order_relaxed));
+		return n > 0 ? static_cast<uint32_t>(n) : 0;
+	}
+	bool empty() const { return size() == 0; }
+	bool full() const { return size() > mask; }
+
+	/*
+	 所有者线程调用，队列满(或窃取者尚未移走该槽位的数据)时返回false
+	*/
+	bool push(T&& val)
+	{
+		uint32_t b = bottom.load(std::memory_order_relaxed);
+		Cell& c = cells[b & mask];
+		if (c.seq.load(std::memory_order_acquire) != b) return false;
+		c.data = std::move(val);
+		c.seq.store(b + 1, std::memory_order_relaxed);
+		bottom.store(b + 1, std::memory_order_release);
+		return true;
+	}
+
+	/*
+	 所有者线程调用，按放入顺序从顶部取出至多n个元素，与窃取者竞争失败时重试
+	 不从底部取，保证线程组消息的处理顺序与投递顺序一致
+	*/
+	uint32_t pop(T* val, uint32_t n)
+	{
+		uint32_t cnt = 0;
+		while (cnt < n && !empty())
+		{
+			if (steal(std::move(val[cnt]))) ++cnt;
+		}
+		return cnt;
+	}
+
+	/*
+	 任意线程调用，从顶部窃取最早放入的元素，与其它线程竞争失败时返回false
+	*/
+	bool steal(T&& val)
+	{
+		uint32_t t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		uint32_t b = bottom.load(std::memory_order_acquire);
+		if (static_cast<int32_t>(b - t) <= 0) return false;
+		if (!top.compare_exchange_strong(t, t + 1,
+			std::memory_order_seq_cst, std::memory_order_relaxed)) return false;
+		Cell& c = cells[t & mask];
+		val = std::move(c.data);
+		c.data = T();
+		c.seq.store(t + mask + 1, std::memory_order_release);
+		return true;
+	}
+
+	/*
+	 批量窃取，至多取走n个且不超过当前元素数的一半(至少1个)
+	*/
+	uint32_t steal(T* val, uint32_t n)
+	{
+		uint32_t half = (size() + 1) / 2;
+		if (n > half) n = half;
+		uint32_t cnt = 0;
+		while (cnt < n && steal(std::move(val[cnt]))) ++cnt;
 		return cnt;
 	}
 };
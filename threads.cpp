@@ -9,15 +9,55 @@
 #include <cassert>
 #include <errno.h>
 
+#if defined(__linux__) && !defined(_DISABLE_ZEROCOPY)
+#include <linux/errqueue.h>
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define _ASYNCPP_ZEROCOPY
+#endif
+#endif
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+#if defined(__linux__) && !defined(_DISABLE_SENDFILE)
+#include <sys/sendfile.h>
+#define _ASYNCPP_SENDFILE
+#endif
+#if defined(__linux__) && !defined(_DISABLE_MMSG)
+#define _ASYNCPP_MMSG //recvmmsg/sendmmsg
+#endif
+#if defined(__linux__) && !defined(SO_PREFER_BUSY_POLL)
+#define SO_PREFER_BUSY_POLL 69 //linux 5.11，旧的glibc头文件中没有
+#endif
+#if defined(__linux__) && !defined(_DISABLE_REUSEPORT_CBPF)
+#include <linux/filter.h>
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(SKF_AD_CPU)
+#define _ASYNCPP_REUSEPORT_CBPF
+#endif
+#endif
+
 using namespace std;
 
 namespace asyncpp
 {
 
+static thread_local BaseThread* s_current_thread = nullptr;
+
+BaseThread* BaseThread::current()
+{
+	return s_current_thread;
+}
+
+void BaseThread::set_current(BaseThread* t)
+{
+	s_current_thread = t;
+}
+
 uint32_t BaseThread::check_timer_and_thread_msg()
 {
 	uint32_t self_msg_cnt = 0;
 	uint32_t pool_msg_cnt = 0;
+	update_clock();
+#ifdef _ASYNCPP_THREAD_QUEUE_SPINLOCK
 	self_msg_cnt = m_msg_queue.pop(m_msg_cache, _ASYNCPP_THREAD_MSG_CACHE_SIZE);
 	for (uint32_t i = 0; i < self_msg_cnt; ++i)
 	{
@@ -27,7 +67,21 @@ uint32_t BaseThread::check_timer_and_thread_msg()
 			m_msg_cache[i].m_dst_thread_id);
 		process_msg(m_msg_cache[i]);
 	}
-	if (get_thread_pool_id() != 0)
+#else
+	//在队列槽位内直接处理，无需先移动到m_msg_cache
+	self_msg_cnt = m_msg_queue.consume([this](ThreadMsg& msg)
+	{
+		_TRACELOG(logger, "msg_type:%d, from %hu:%hu, to %hu:%hu",
+			msg.m_type, msg.m_src_thread_pool_id, msg.m_src_thread_id,
+			msg.m_dst_thread_pool_id, msg.m_dst_thread_id);
+		process_msg(msg);
+	}, _ASYNCPP_THREAD_MSG_CACHE_SIZE);
+#endif
+	if (m_work_deque != nullptr)
+	{
+		pool_msg_cnt = check_work_msg();
+	}
+	else if (get_thread_pool_id() != 0)
 	{
 		pool_msg_cnt = m_master->pop(m_msg_cache, _ASYNCPP_THREAD_MSG_CACHE_SIZE);
 		for (uint32_t i = 0; i < pool_msg_cnt; ++i)
@@ -45,6 +99,85 @@ uint32_t BaseThread::check_timer_and_thread_msg()
 	return self_msg_cnt + pool_msg_cnt + timer_cnt;
 }
 
+uint32_t BaseThread::check_work_msg()
+{
+	uint32_t cnt = 0;
+	ThreadMsg msg;
+	bool held = false; //槽位仍被窃取者占用而未能转入的消息，在本地队列之后处理以保持顺序
+	//收件箱中的消息先转入本地队列，使其可被兄弟线程窃取
+	while (!m_work_deque->full() && m_work_inbox->pop(std::move(msg)))
+	{
+		if (!m_work_deque->push(std::move(msg)))
+		{
+			held = true;
+			cnt = 1;
+			break;
+		}
+	}
+
+	uint32_t n = m_work_deque->pop(m_msg_cache, _ASYNCPP_THREAD_MSG_CACHE_SIZE);
+	if (n < _ASYNCPP_THREAD_MSG_CACHE_SIZE && !m_master->empty_hint())
+	{ //本地队列都满时退回共享队列的消息
+		n += m_master->pop(m_msg_cache + n, _ASYNCPP_THREAD_MSG_CACHE_SIZE - n);
+	}
+	if (n == 0 && cnt == 0)
+	{
+		n = m_master->steal_msg(this, m_msg_cache, _ASYNCPP_THREAD_MSG_CACHE_SIZE);
+	}
+	else if (m_work_deque->size() > _ASYNCPP_THREAD_MSG_CACHE_SIZE)
+	{ //本线程积压，唤醒空闲线程分担
+		m_master->wakeup_one();
+	}
+	//先于held入队的消息数，处理过程中新投递到本地队列的消息在held之后
+	uint32_t older = held ? m_work_deque->size() : 0;
+
+	for (uint32_t i = 0; i < n; ++i)
+	{
+		_TRACELOG(logger, "msg_type:%d, from %hu:%hu, to %hu:%hu",
+			m_msg_cache[i].m_type, m_msg_cache[i].m_src_thread_pool_id,
+			m_msg_cache[i].m_src_thread_id, m_msg_cache[i].m_dst_thread_pool_id,
+			m_msg_cache[i].m_dst_thread_id);
+		process_msg(m_msg_cache[i]);
+	}
+	if (held)
+	{ //本地队列中更早的消息先处理完
+		uint32_t m;
+		while (older > 0 && (m = m_work_deque->pop(m_msg_cache,
+			older < _ASYNCPP_THREAD_MSG_CACHE_SIZE ? older : _ASYNCPP_THREAD_MSG_CACHE_SIZE)) != 0)
+		{
+			for (uint32_t i = 0; i < m; ++i) process_msg(m_msg_cache[i]);
+			n += m;
+			older -= m;
+		}
+		process_msg(msg);
+	}
+	return cnt + n;
+}
+
+bool BaseThread::has_pending_msg() const
+{
+	if (!m_msg_queue.empty()) return true;
+	if (m_work_deque != nullptr)
+	{
+		return !m_work_deque->empty() || !m_work_inbox->empty()
+			|| !m_master->empty_hint() || m_master->has_stealable_msg();
+	}
+	return get_thread_pool_id() != 0 && !m_master->empty();
+}
+
+void BaseThread::idle()
+{
+	m_notifier.prepare_park();
+	if (has_pending_msg() || get_asynframe()->end())
+	{
+		m_notifier.cancel_park();
+		return;
+	}
+	update_clock();
+	park(next_timer_wait_us());
+	update_clock();
+}
+
 void BaseThread::run()
 {
 	while (!get_asynframe()->end())
@@ -52,7 +185,7 @@ void BaseThread::run()
 		uint32_t msg_cnt = check_timer_and_thread_msg();
 		if (msg_cnt == 0)
 		{
-			usleep(50 * 1000);
+			idle();
 		}
 	}
 }
@@ -175,28 +308,151 @@ void DnsThread::on_timer(uint32_t timerid, uint32_t type, uint64_t ctx)
 	//}
 }
 
+SOCKET_HANDLE NetBaseThread::accept_client(NetConnect* listener, AcceptedClient& client)
+{
+	struct sockaddr_storage addr;
+	socklen_t len = sizeof addr;
+#ifdef _ASYNCPP_ACCEPT4
+	client.fd = accept4(listener->m_fd, reinterpret_cast<struct sockaddr*>(&addr), &len,
+		SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+	client.fd = accept(listener->m_fd, reinterpret_cast<struct sockaddr*>(&addr), &len);
+#endif
+	if (client.fd != INVALID_SOCKET && addr.ss_family == AF_INET)
+	{
+		memcpy(&client.addr, &addr, sizeof client.addr);
+	}
+	else memset(&client.addr, 0, sizeof client.addr);
+	return client.fd;
+}
+
+bool NetBaseThread::send_accepted_clients(thread_pool_id_t thread_pool,
+	thread_id_t thread, char* clients, uint32_t cnt)
+{
+	bool bSuccess = get_asynframe()->send_thread_msg2(
+		NET_ACCEPT_CLIENT_REQ, clients,
+		static_cast<uint32_t>(sizeof(AcceptedClient) * cnt), MsgBufferType::NEW,
+		{static_cast<uint64_t>(cnt)}, MsgContextType::STATIC,
+		thread_pool, thread, this, false);
+	if (!bSuccess)
+	{
+		auto p = reinterpret_cast<const AcceptedClient*>(clients);
+		for (uint32_t i = 0; i < cnt; ++i)
+		{
+			_WARNLOG(logger, "queue full, close sockfd:%d", (int)p[i].fd);
+			::closesocket(p[i].fd);
+		}
+		delete[] clients;
+	}
+	return bSuccess;
+}
+
+thread_id_t NetBaseThread::select_client_thread(NetConnect* listener,
+	const AcceptedClient& client)
+{
+	if (listener->m_client_thread != INVALID_THREAD_ID
+		|| listener->m_placement == ClientPlacement::ANY)
+	{
+		return listener->m_client_thread;
+	}
+	auto& threads = get_asynframe()->get_thread_pool(
+		listener->m_client_thread_pool)->get_threads();
+	uint32_t n = static_cast<uint32_t>(threads.size());
+	if (n == 0) return INVALID_THREAD_ID;
+	uint32_t sel = 0;
+	switch (listener->m_placement)
+	{
+	case ClientPlacement::ROUND_ROBIN:
+		sel = m_next_client_thread++ % n;
+		break;
+	case ClientPlacement::LEAST_CONN:
+	case ClientPlacement::LEAST_BYTES:
+	{ //连接数或字节数相同时取连接数少的，再相同取id小的
+		uint32_t now = static_cast<uint32_t>(g_unix_timestamp);
+		uint64_t min_load = UINT64_MAX;
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			auto t = static_cast<NetBaseThread*>(threads[i]);
+			uint64_t conns = t->m_load_conns.load(std::memory_order_relaxed);
+			uint64_t load = conns;
+			if (listener->m_placement == ClientPlacement::LEAST_BYTES)
+			{
+				uint64_t v = t->m_load_bytes.load(std::memory_order_relaxed);
+				//超过1s未更新说明线程空闲，字节数按0计
+				uint64_t bytes = static_cast<uint32_t>(v >> 32) + 1 >= now ? v & UINT32_MAX : 0;
+				load = bytes << 32 | (conns > UINT32_MAX ? UINT32_MAX : conns);
+			}
+			if (load < min_load)
+			{
+				min_load = load;
+				sel = i;
+			}
+		}
+	}
+		break;
+	case ClientPlacement::PEER_HASH:
+	{ //非ipv4的客户端没有地址，按fd分配
+		uint32_t key = client.addr.sin_family == AF_INET
+			? static_cast<uint32_t>(client.addr.sin_addr.s_addr)
+			: static_cast<uint32_t>(client.fd);
+		sel = static_cast<uint32_t>(static_cast<uint64_t>(key * 2654435761u) * n >> 32);
+	}
+		break;
+	default:
+		return INVALID_THREAD_ID;
+	}
+	//目标线程下次更新前，先计入刚分配的连接，避免一批连接都选中同一线程
+	static_cast<NetBaseThread*>(threads[sel])->m_load_conns.fetch_add(1, std::memory_order_relaxed);
+	return static_cast<thread_id_t>(sel);
+}
+
 uint32_t NetBaseThread::do_accept(NetConnect* conn)
 {
 	uint32_t accept_cnt = 0;
+	bool batched = false; //m_accept_batches中有未发送的客户端
 	for (;;)
 	{
-		SOCKET_HANDLE fd = accept(conn->m_fd, nullptr, nullptr);
+		AcceptedClient client;
+		SOCKET_HANDLE fd = accept_client(conn, client);
 		if (fd != INVALID_SOCKET)
 		{
 			_DEBUGLOG(logger, "sockfd:%d accept %d", conn->m_fd, fd);
 			int32_t ret = on_accept(fd);
 			if (ret == 0)
 			{
-				bool bSuccess = get_asynframe()->send_thread_msg(
-					NET_ACCEPT_CLIENT_REQ, nullptr, 0, MsgBufferType::STATIC,
-					{static_cast<uint64_t>(fd)}, MsgContextType::STATIC,
-					conn->m_client_thread_pool, conn->m_client_thread,
-					this, false);
-				if (!bSuccess)
-				{
-					_WARNLOG(logger, "queue full, close sockfd:%d", fd);
-					::closesocket(fd);
-					break;
+				thread_id_t target = select_client_thread(conn, client);
+				if (conn->m_client_thread_pool == get_thread_pool_id()
+					&& target == get_id())
+				{ //由本线程处理，不经过消息队列
+					add_accepted_conn(client);
+					++accept_cnt;
+					continue;
+				}
+				if (target == INVALID_THREAD_ID)
+				{ //由线程组中先取到消息的线程处理，逐个转交以免集中到一个线程
+					char* buf = new char[sizeof client];
+					memcpy(buf, &client, sizeof client);
+					if (!send_accepted_clients(conn->m_client_thread_pool,
+						target, buf, 1))
+					{
+						break;
+					}
+				}
+				else
+				{ //本次accept的发往同一线程的连接合并为一个消息
+					if (m_accept_batches.size() <= target) m_accept_batches.resize(target + 1u);
+					auto& batch = m_accept_batches[target];
+					if (batch.first == nullptr) batch.first = new char[sizeof client * _ASYNCPP_ACCEPT_BATCH];
+					memcpy(batch.first + sizeof client * batch.second, &client, sizeof client);
+					batched = true;
+					if (++batch.second == _ASYNCPP_ACCEPT_BATCH)
+					{
+						bool bSuccess = send_accepted_clients(conn->m_client_thread_pool,
+							target, batch.first, batch.second);
+						batch.first = nullptr;
+						batch.second = 0;
+						if (!bSuccess) break;
+					}
 				}
 			}
 			else
@@ -214,12 +470,28 @@ uint32_t NetBaseThread::do_accept(NetConnect* conn)
 			int32_t errcode = GET_SOCK_ERR();
 			if (errcode != WSAEWOULDBLOCK && errcode != EAGAIN && errcode != WSAEINTR)
 			{
-				on_error_event(conn);
+				on_error_event(conn, errcode);
 				_WARNLOG(logger, "sockfd:%d accept error:%d[%s]", conn->m_fd, errcode, strerror(errno));
 			}
+			else if (errcode != WSAEINTR)
+			{
+				conn->m_ready_events &= ~SELIN;
+			}
 			break;
 		}
 	}
+	if (batched)
+	{
+		for (size_t i = 0; i < m_accept_batches.size(); ++i)
+		{
+			auto& batch = m_accept_batches[i];
+			if (batch.second == 0) continue;
+			send_accepted_clients(conn->m_client_thread_pool,
+				static_cast<thread_id_t>(i), batch.first, batch.second);
+			batch.first = nullptr;
+			batch.second = 0;
+		}
+	}
 	return accept_cnt;
 }
 
@@ -234,6 +506,7 @@ uint32_t NetBaseThread::do_connect(NetConnect* conn)
 	{ //connect success
 		conn->m_state = NetConnectState::NET_CONN_CONNECTED;
 		change_timer(conn->m_timerid, m_idle_timeout);
+		conn->m_last_active_us = m_now_us;
 		on_connect(conn);
 		return 1;
 	}
@@ -249,37 +522,191 @@ uint32_t NetBaseThread::do_connect(NetConnect* conn)
 	return 0;
 }
 
+/*
+ 一次发送多段数据
+ @return 发送的字节数，<0表示出错
+*/
+static int32_t send_iov(SOCKET_HANDLE fd, struct iovec* iov, int32_t iovcnt, int flags)
+{
+#ifdef _WIN32
+	WSABUF bufs[_ASYNCPP_SEND_IOV_MAX];
+	for (int32_t i = 0; i < iovcnt; ++i)
+	{
+		bufs[i].buf = static_cast<CHAR*>(iov[i].iov_base);
+		bufs[i].len = static_cast<ULONG>(iov[i].iov_len);
+	}
+	DWORD n = 0;
+	if (WSASend(fd, bufs, iovcnt, &n, 0, nullptr, nullptr) != 0) return -1;
+	return static_cast<int32_t>(n);
+#else
+	if (iovcnt == 1) return ::send(fd, iov[0].iov_base, iov[0].iov_len, MSG_NOSIGNAL | flags);
+	struct msghdr mh;
+	memset(&mh, 0, sizeof mh);
+	mh.msg_iov = iov;
+	mh.msg_iovlen = iovcnt;
+	return static_cast<int32_t>(::sendmsg(fd, &mh, MSG_NOSIGNAL | flags));
+#endif
+}
+
+/*
+ 发送文件或管道中的最多len字节
+ 不支持sendfile的平台上先读入栈上缓冲区再发送，未发出的部分下次重新读取
+ @return 发送的字节数，0表示文件已结束或管道写端已关闭，<0表示出错
+*/
+#ifdef _ASYNCPP_SENDFILE
+//管道中是否有数据可读，写端已关闭也算可读
+static bool pipe_readable(int32_t fd)
+{
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	return ::poll(&pfd, 1, 0) != 0;
+}
+#endif
+
+static int32_t send_file_part(SOCKET_HANDLE fd, const SendMsgType& msg, uint32_t len)
+{
+#if defined(_ASYNCPP_SENDFILE)
+	if (msg.source == SendMsgSource::PIPE)
+	{
+		return static_cast<int32_t>(splice(msg.file_fd, nullptr, fd, nullptr, len,
+			SPLICE_F_MOVE | SPLICE_F_NONBLOCK));
+	}
+	off_t off = static_cast<off_t>(msg.file_offset + msg.bytes_sent);
+	return static_cast<int32_t>(sendfile(fd, msg.file_fd, &off, len));
+#elif !defined(_WIN32)
+	char buf[16384];
+	if (len > sizeof buf) len = sizeof buf;
+	ssize_t n = pread(msg.file_fd, buf, len, static_cast<off_t>(msg.file_offset + msg.bytes_sent));
+	if (n <= 0) return static_cast<int32_t>(n);
+	return static_cast<int32_t>(::send(fd, buf, n, MSG_NOSIGNAL));
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
 uint32_t NetBaseThread::do_send(NetConnect* conn)
 {
+	if (conn->m_dgram) return do_send_dgram(conn);
+#if defined(IOV_MAX) && IOV_MAX < _ASYNCPP_SEND_IOV_MAX
+	const int32_t iov_max = IOV_MAX;
+#else
+	const int32_t iov_max = _ASYNCPP_SEND_IOV_MAX;
+#endif
+	struct iovec iov[_ASYNCPP_SEND_IOV_MAX];
 	uint32_t bytes_sent = 0;
 	const auto& s = m_ss.get_cur_speed();
 	if (s.second >= m_sendspeedlimit) return 0;
+	if (!conn->m_zc_list.empty()) reap_zerocopy(conn);
 
 	while (!conn->m_send_list.empty())
 	{
-		SendMsgType& msg = conn->m_send_list.front();
-		int32_t try_send = msg.data_len - msg.bytes_sent;
-		if (try_send + s.second > m_sendspeedlimit)
+		//限速时本次最多发送的字节数
+		uint32_t quota = UINT32_MAX;
+		if (m_sendspeedlimit != SPEEDUNLIMITED)
+		{
+			if (m_sendspeedlimit > s.second + bytes_sent) quota = m_sendspeedlimit - s.second - bytes_sent;
+			else quota = 0;
+		}
+
+		int32_t iovcnt = 0;
+		uint32_t try_send = 0;
+		int flags = 0;
+		int32_t n;
+		SendMsgType& head = conn->m_send_list.front();
+		if (head.source != SendMsgSource::BUFFER)
+		{ //文件单独发送
+			uint32_t len = head.data_len - head.bytes_sent;
+			if (quota == 0) try_send = rand() % len % 512 + 1;
+			else try_send = len < quota ? len : quota;
+			iovcnt = 1;
+			n = send_file_part(conn->m_fd, head, try_send);
+			if (n >= 0) cancel_pipe_retry(conn); //管道已有数据或已结束
+			if (n == 0)
+			{ //文件被截断或管道写端已关闭，丢弃剩余部分
+				_WARNLOG(logger, "sockfd:%d file %d ended, %uB not sent", conn->m_fd, head.file_fd, len);
+				head.release();
+				conn->m_send_list.pop_front();
+				continue;
+			}
+		}
+		else
 		{
-			if (m_sendspeedlimit > s.second) try_send = m_sendspeedlimit - s.second;
-			else try_send = rand() % try_send % 512 + 1;
-			_TRACELOG(logger, "speedlimit, try send:%d", try_send);
+			//合并队首的多条消息，遇到文件为止，零拷贝发送的消息单独发送
+			for (auto it = conn->m_send_list.begin();
+				it != conn->m_send_list.end() && iovcnt < iov_max && try_send < quota; ++it)
+			{
+				if (it->source != SendMsgSource::BUFFER) break;
+				if (m_zerocopy_threshold != 0 && use_zerocopy(conn, *it))
+				{
+					if (iovcnt > 0) break;
+#ifdef _ASYNCPP_ZEROCOPY
+					flags = MSG_ZEROCOPY;
+#endif
+				}
+				uint32_t len = it->data_len - it->bytes_sent;
+				if (len > quota - try_send) len = quota - try_send;
+				iov[iovcnt].iov_base = it->data + it->bytes_sent;
+				iov[iovcnt].iov_len = len;
+				++iovcnt;
+				try_send += len;
+				if (flags != 0) break;
+			}
+			if (quota == 0)
+			{ //已超出限速，随机发送少量数据
+				uint32_t len = head.data_len - head.bytes_sent;
+				try_send = len != 0 ? rand() % len % 512 + 1 : 0;
+				iov[0].iov_base = head.data + head.bytes_sent;
+				iov[0].iov_len = try_send;
+				iovcnt = 1;
+				_TRACELOG(logger, "speedlimit, try send:%u", try_send);
+			}
+
+			n = send_iov(conn->m_fd, iov, iovcnt, flags);
+			if (n < 0 && flags != 0 && GET_SOCK_ERR() == ENOBUFS)
+			{ //超出optmem限制，本次改为普通发送
+				flags = 0;
+				n = send_iov(conn->m_fd, iov, iovcnt, flags);
+			}
 		}
-		int32_t n = ::send(conn->m_fd, msg.data + msg.bytes_sent, try_send, MSG_NOSIGNAL);
 		if (n >= 0)
 		{
 			bytes_sent += n;
-			msg.bytes_sent += n;
-			_DEBUGLOG(logger, "sockfd:%d send %uB, bytes_sent:%uB, total:%uB",
-				conn->m_fd, n, msg.bytes_sent, msg.data_len);
-			if (msg.bytes_sent == msg.data_len)
+			if (flags != 0)
 			{
-				free_buffer(msg.data, msg.buf_type);
-				conn->m_send_list.pop();
+				++conn->m_zc_seq;
+				conn->m_zc_head = true;
+			}
+			_DEBUGLOG(logger, "sockfd:%d send %uB in %d parts, try:%uB",
+				conn->m_fd, n, iovcnt, try_send);
+
+			//按已发送字节数依次核销消息，部分发送的留在队首
+			uint32_t left = static_cast<uint32_t>(n);
+			while (!conn->m_send_list.empty())
+			{
+				SendMsgType& msg = conn->m_send_list.front();
+				uint32_t remain = msg.data_len - msg.bytes_sent;
+				if (left < remain)
+				{
+					msg.bytes_sent += left;
+					break;
+				}
+				left -= remain;
+				if (conn->m_zc_head)
+				{ //等待内核释放页面
+					conn->m_zc_list.push_back({ msg.data, msg.data_len,
+						conn->m_zc_seq - 1, msg.buf_type });
+					conn->m_zc_head = false;
+				}
+				else msg.release();
+				conn->m_send_list.pop_front();
 			}
 
 			///TODO: return if n==0
 
+			if (static_cast<uint32_t>(n) < try_send) break; //发送缓冲区已满
 			if (bytes_sent + s.second >= m_sendspeedlimit) break;
 		}
 		else
@@ -288,9 +715,24 @@ uint32_t NetBaseThread::do_send(NetConnect* conn)
 			if (errcode != WSAEWOULDBLOCK && errcode != EAGAIN && errcode != WSAEINTR)
 			{
 				///TODO: drop msg if fail several times
-				on_error_event(conn);
+				on_error_event(conn, errcode);
 				_WARNLOG(logger, "sockfd:%d error:%d[%s]", conn->m_fd, errcode, strerror(errno));
 			}
+			else if (errcode != WSAEINTR)
+			{ //发送缓冲区已满，等待下一次可写事件
+				conn->m_ready_events &= ~SELOUT;
+#ifdef _ASYNCPP_SENDFILE
+				if (head.source == SendMsgSource::PIPE && !pipe_readable(head.file_fd))
+				{ //实际是管道暂时没有数据，可写事件不会再通知，改为定时重试
+					set_read_event(conn);
+					if (conn->m_pipe_timerid < 0)
+					{
+						conn->m_pipe_timerid = add_timer_us(_ASYNCPP_PIPE_RETRY_US,
+							NetPipeRetryTimer, conn->id());
+					}
+				}
+#endif
+			}
 			break;
 		}
 	}
@@ -299,19 +741,200 @@ uint32_t NetBaseThread::do_send(NetConnect* conn)
 
 	if (bytes_sent > 0)
 	{
-		change_timer(conn->m_timerid, m_idle_timeout);
+		touch_idle_timer(conn);
 	}
 	return bytes_sent;
 }
 
+uint32_t NetBaseThread::broadcast(const std::vector<uint32_t>& conn_ids, char* buf, uint32_t len)
+{
+	uint32_t cnt = 0;
+	for (uint32_t conn_id : conn_ids)
+	{
+		NetConnect* conn = get_conn(conn_id);
+		if (conn == nullptr
+			|| (conn->m_state != NetConnectState::NET_CONN_CONNECTED
+				&& conn->m_state != NetConnectState::NET_CONN_CONNECTING)
+			|| conn->send_queue_full())
+		{
+			continue;
+		}
+		if (conn->m_send_list.empty())
+		{
+			set_rdwr_event(conn);
+		}
+		//入队只增加连接上的引用，发送在本函数返回之后，调用者的引用保证buf有效
+		conn->send(buf, len, MsgBufferType::SHARED);
+		++cnt;
+	}
+	_DEBUGLOG(logger, "broadcast %uB to %u/%zu conns", len, cnt, conn_ids.size());
+
+	//一次性补上各连接的引用，再释放调用者的引用
+	if (cnt > 1) ref_shared_buffer(buf, cnt - 1);
+	else if (cnt == 0) free_buffer(buf, MsgBufferType::SHARED);
+	return cnt;
+}
+
+int32_t NetBaseThread::send_file(NetConnect* conn, int32_t fd, uint64_t offset, uint64_t length,
+	bool close_fd)
+{
+	if (conn->m_state != NetConnectState::NET_CONN_CONNECTED
+		&& conn->m_state != NetConnectState::NET_CONN_CONNECTING)
+	{
+		_WARNLOG(logger, "conn %d error state:%d", (int)conn->m_fd, (int)conn->m_state);
+		assert(0);
+		return EBUSY;
+	}
+#ifdef _WIN32
+	_WARNLOG(logger, "conn %d send_file not supported", (int)conn->m_fd);
+	return ENOTSUP;
+#else
+	if (conn->m_dgram) return ENOTSUP;
+	struct stat st;
+	if (fstat(fd, &st) != 0) return errno;
+	SendMsgSource source;
+	if (S_ISREG(st.st_mode))
+	{
+		source = SendMsgSource::FILE;
+		uint64_t file_size = static_cast<uint64_t>(st.st_size);
+		if (offset > file_size) return EINVAL;
+		if (length == 0) length = file_size - offset;
+	}
+	else if (S_ISFIFO(st.st_mode))
+	{
+#ifdef _ASYNCPP_SENDFILE
+		if (length == 0) return EINVAL;
+		source = SendMsgSource::PIPE;
+		offset = 0;
+#else
+		return ENOTSUP; //读出后无法放回管道
+#endif
+	}
+	else return EINVAL;
+
+	_DEBUGLOG(logger, "conn %d send file %d %" PRIu64 "B", (int)conn->m_fd, fd, length);
+	if (length == 0)
+	{
+		if (close_fd) ::close(fd);
+		return 0;
+	}
+	if (conn->m_send_list.empty())
+	{
+		set_rdwr_event(conn);
+	}
+	return conn->send_file(fd, offset, length, source, close_fd);
+#endif
+}
+
+bool NetBaseThread::use_zerocopy(NetConnect* conn, const SendMsgType& msg)
+{
+#ifdef _ASYNCPP_ZEROCOPY
+	if (msg.data_len < m_zerocopy_threshold || conn->m_zc_state < 0) return false;
+	if (conn->m_zc_state == 0)
+	{
+		int one = 1;
+		if (setsockopt(conn->m_fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof one) == 0)
+		{
+			conn->m_zc_state = 1;
+		}
+		else
+		{
+			_INFOLOG(logger, "sockfd:%d set SO_ZEROCOPY fail:%d[%s]", conn->m_fd, errno, strerror(errno));
+			conn->m_zc_state = -1;
+			return false;
+		}
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+uint32_t NetBaseThread::reap_zerocopy(NetConnect* conn)
+{
+	uint32_t cnt = 0;
+#ifdef _ASYNCPP_ZEROCOPY
+	char control[128];
+	for (;;)
+	{
+		struct msghdr msg;
+		memset(&msg, 0, sizeof msg);
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof control;
+		if (recvmsg(conn->m_fd, &msg, MSG_ERRQUEUE) < 0) break;
+
+		for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm))
+		{
+			if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+				&& !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+			{
+				continue;
+			}
+			auto serr = reinterpret_cast<struct sock_extended_err*>(CMSG_DATA(cm));
+			if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+
+			//序号[ee_info, ee_data]已完成，TCP上按顺序完成
+			uint32_t last = serr->ee_data;
+			_TRACELOG(logger, "sockfd:%d zerocopy done %u-%u%s", conn->m_fd, serr->ee_info, last,
+				serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED ? " copied" : "");
+			++cnt;
+			while (!conn->m_zc_list.empty()
+				&& static_cast<int32_t>(conn->m_zc_list.front().seq - last) <= 0)
+			{
+				ZeroCopyMsg zc = conn->m_zc_list.front();
+				conn->m_zc_list.pop_front();
+				on_zerocopy_done(conn, zc.data, zc.data_len, zc.buf_type);
+			}
+		}
+	}
+#endif
+	return cnt;
+}
+
+void NetBaseThread::close_after_zerocopy(NetConnect* conn)
+{
+	if (!conn->m_zc_list.empty()) reap_zerocopy(conn);
+	if (conn->m_zc_list.empty())
+	{
+		remove_conn(conn);
+	}
+	else if (!conn->m_zc_linger)
+	{ //内核可能仍在发送这些消息的页面，完成通知到达(错误事件)后再关闭
+		_DEBUGLOG(logger, "sockfd:%d wait %u zerocopy msgs", conn->m_fd, conn->m_zc_list.size());
+		conn->m_zc_linger = true;
+		set_read_event(conn); //不再关注可写事件，水平触发时不空转
+		if (conn->m_timerid >= 0) del_timer(conn->m_timerid);
+		conn->m_timerid = add_timer(_ASYNCPP_ZEROCOPY_LINGER, NetTimeoutTimer, conn->id());
+	}
+}
+
+void NetBaseThread::abort_zerocopy(NetConnect* conn)
+{
+	struct linger lg;
+	lg.l_onoff = 1;
+	lg.l_linger = 0; //close时丢弃发送队列并发送RST
+	if (setsockopt(conn->m_fd, SOL_SOCKET, SO_LINGER, reinterpret_cast<char*>(&lg), sizeof lg) != 0)
+	{
+		_WARNLOG(logger, "sockfd:%d set SO_LINGER fail:%d[%s]", conn->m_fd, errno, strerror(errno));
+	}
+	remove_conn(conn);
+}
+
 uint32_t NetBaseThread::do_recv(NetConnect* conn)
 {
+	if (conn->m_dgram) return do_recv_dgram(conn);
 	uint32_t bytes_recv = 0;
+	int32_t peak = 0; //缓冲区用到的最大长度
 	const auto& s = m_ss.get_cur_speed();
 	if (s.first >= m_recvspeedlimit) return 0;
 
 L_READ:
 	int32_t len = conn->m_recv_buf_len - conn->m_recv_len;
+	if (conn->m_recv_pos > 0 && len < (conn->m_recv_pos + conn->m_recv_buf_len) / 4)
+	{ //剩余空间不足1/4时才将未处理的数据移到开头
+		conn->compact_recv_buffer();
+		len = conn->m_recv_buf_len - conn->m_recv_len;
+	}
 	if (len == 0)
 	{
 		conn->enlarge_recv_buffer();
@@ -332,9 +955,10 @@ L_READ:
 	{ //recv data
 		bytes_recv += recv_len;
 		conn->m_recv_len += recv_len;
+		if (conn->m_recv_pos + conn->m_recv_len > peak) peak = conn->m_recv_pos + conn->m_recv_len;
 		_DEBUGLOG(logger, "sockfd:%d recv %uB, total:%uB",
 			conn->m_fd, recv_len, conn->m_recv_len);
-		change_timer(conn->m_timerid, m_idle_timeout);
+		touch_idle_timer(conn);
 		int32_t package_len = frame(conn);
 		if (package_len == conn->m_recv_len)
 		{ //recv one package
@@ -343,7 +967,7 @@ L_READ:
 			//memory barrier
 			assert(memcmp(conn->m_recv_buf + conn->m_recv_buf_len + 16, "ASYNCPPMEMORYBAR", 16) == 0);
 #endif
-			conn->m_recv_len = 0;
+			conn->consume_recv(conn->m_recv_len);
 			conn->m_header_len = 0;
 			conn->m_body_len = 0;
 		}
@@ -367,9 +991,7 @@ L_READ:
 					//memory barrier
 					assert(memcmp(conn->m_recv_buf + conn->m_recv_buf_len + 16, "ASYNCPPMEMORYBAR", 16) == 0);
 #endif
-					memmove(conn->m_recv_buf,
-						conn->m_recv_buf + package_len, remain_len);
-					conn->m_recv_len = remain_len;
+					conn->consume_recv(package_len);
 					conn->m_header_len = 0;
 					conn->m_body_len = 0;
 					package_len = frame(conn);
@@ -386,10 +1008,16 @@ L_READ:
 			conn->enlarge_recv_buffer(package_len);
 		}
 
-		if (bytes_recv + s.first < m_recvspeedlimit && recv_len == len)
+		if (recv_len < len)
+		{ //未读满说明接收缓冲区已空
+			conn->m_ready_events &= ~SELIN;
+		}
+		else if (bytes_recv + s.first < m_recvspeedlimit)
 		{
 			goto L_READ;
 		}
+		//数据已处理完，归还缓冲区
+		conn->release_recv_buffer(peak);
 	}
 	else if (recv_len == 0)
 	{ //peer close conn ///TODO: 半关闭
@@ -423,13 +1051,264 @@ L_READ:
 		if (errcode != WSAEWOULDBLOCK && errcode != EAGAIN && errcode != WSAEINTR)
 		{
 			_WARNLOG(logger, "sockfd:%d error:%d[%s]", conn->m_fd, errcode, strerror(errno));
-			on_error_event(conn);
+			on_error_event(conn, errcode);
+		}
+		else if (errcode != WSAEINTR)
+		{
+			conn->m_ready_events &= ~SELIN;
+		}
+	}
+
+	return bytes_recv;
+}
+
+//SendMsgType::peer与地址互相转换
+static uint64_t pack_peer(const struct sockaddr_in& addr)
+{
+	return static_cast<uint64_t>(addr.sin_addr.s_addr) << 16 | addr.sin_port;
+}
+static void unpack_peer(uint64_t peer, struct sockaddr_in& addr)
+{
+	memset(&addr, 0, sizeof addr);
+	if (peer == 0) return; //sin_family为0表示发往connect的对端
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = static_cast<uint32_t>(peer >> 16);
+	addr.sin_port = static_cast<uint16_t>(peer);
+}
+
+/*
+ 一次接收最多cnt个数据报，第i个存放在buf + i * size，来源地址存入addrs[i]
+ @return 收到的数据报数，<0表示出错；lens[i]<0表示该数据报超过size被截断
+*/
+static int32_t recv_dgrams(SOCKET_HANDLE fd, char* buf, int32_t size, int32_t cnt,
+	struct sockaddr_in* addrs, int32_t* lens)
+{
+#ifdef _ASYNCPP_MMSG
+	struct mmsghdr msgs[_ASYNCPP_UDP_BATCH];
+	struct iovec iov[_ASYNCPP_UDP_BATCH];
+	if (cnt > _ASYNCPP_UDP_BATCH) cnt = _ASYNCPP_UDP_BATCH;
+	memset(msgs, 0, sizeof(msgs[0]) * cnt);
+	for (int32_t i = 0; i < cnt; ++i)
+	{
+		iov[i].iov_base = buf + i * size;
+		iov[i].iov_len = size;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &addrs[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof addrs[i];
+	}
+	int32_t n = recvmmsg(fd, msgs, cnt, 0, nullptr);
+	for (int32_t i = 0; i < n; ++i)
+	{
+		lens[i] = msgs[i].msg_hdr.msg_flags & MSG_TRUNC ? -1
+			: static_cast<int32_t>(msgs[i].msg_len);
+	}
+	return n;
+#else
+	int32_t n = 0;
+	for (; n < cnt; ++n)
+	{
+		socklen_t addrlen = sizeof addrs[n];
+		int32_t len = static_cast<int32_t>(recvfrom(fd, buf + n * size, size, 0,
+			reinterpret_cast<struct sockaddr*>(&addrs[n]), &addrlen));
+		if (len < 0)
+		{
+#ifdef _WIN32
+			if (GET_SOCK_ERR() == WSAEMSGSIZE)
+			{
+				lens[n] = -1;
+				continue;
+			}
+#endif
+			return n > 0 ? n : -1;
+		}
+		lens[n] = len;
+	}
+	return n;
+#endif
+}
+
+/*
+ 一次发送cnt个数据报，addrs[i].sin_family为0的发往connect的对端
+ @return 发送的数据报数，<0表示第一个就出错
+*/
+static int32_t send_dgrams(SOCKET_HANDLE fd, struct iovec* iov, struct sockaddr_in* addrs, int32_t cnt)
+{
+#ifdef _ASYNCPP_MMSG
+	struct mmsghdr msgs[_ASYNCPP_UDP_BATCH];
+	memset(msgs, 0, sizeof(msgs[0]) * cnt);
+	for (int32_t i = 0; i < cnt; ++i)
+	{
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		if (addrs[i].sin_family != 0)
+		{
+			msgs[i].msg_hdr.msg_name = &addrs[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof addrs[i];
 		}
 	}
+	return sendmmsg(fd, msgs, cnt, MSG_NOSIGNAL);
+#else
+	int32_t n = 0;
+	for (; n < cnt; ++n)
+	{
+		int32_t ret = static_cast<int32_t>(sendto(fd,
+			static_cast<const char*>(iov[n].iov_base), iov[n].iov_len, 0,
+			addrs[n].sin_family != 0 ? reinterpret_cast<const struct sockaddr*>(&addrs[n]) : nullptr,
+			addrs[n].sin_family != 0 ? sizeof addrs[n] : 0));
+		if (ret < 0) return n > 0 ? n : -1;
+	}
+	return n;
+#endif
+}
+
+uint32_t NetBaseThread::do_recv_dgram(NetConnect* conn)
+{
+	const int32_t size = _ASYNCPP_UDP_DGRAM_SIZE;
+	struct sockaddr_in addrs[_ASYNCPP_UDP_BATCH];
+	int32_t lens[_ASYNCPP_UDP_BATCH];
+	uint32_t bytes_recv = 0;
+	const auto& s = m_ss.get_cur_speed();
+	if (s.first >= m_recvspeedlimit) return 0;
+
+	//一批数据报按size间隔存放在同一块缓冲区中，处理完后还给池
+	assert(conn->m_recv_len == 0);
+	conn->enlarge_recv_buffer(size * _ASYNCPP_UDP_BATCH);
+	char* base = conn->recv_buf_base();
+	int32_t cap = conn->m_recv_pos + conn->m_recv_buf_len;
+	for (;;)
+	{
+		int32_t n = recv_dgrams(conn->m_fd, base, size, _ASYNCPP_UDP_BATCH, addrs, lens);
+		if (n < 0)
+		{
+			int32_t errcode = GET_SOCK_ERR();
+			if (errcode != WSAEWOULDBLOCK && errcode != EAGAIN && errcode != WSAEINTR)
+			{
+				_WARNLOG(logger, "sockfd:%d error:%d[%s]", conn->m_fd, errcode, strerror(errno));
+				on_error_event(conn, errcode);
+			}
+			else if (errcode != WSAEINTR)
+			{
+				conn->m_ready_events &= ~SELIN;
+			}
+			break;
+		}
+		_DEBUGLOG(logger, "sockfd:%d recv %d datagrams", conn->m_fd, n);
 
+		for (int32_t i = 0; i < n; ++i)
+		{
+			if (lens[i] < 0)
+			{
+				_WARNLOG(logger, "sockfd:%d drop datagram longer than %dB", conn->m_fd, size);
+				continue;
+			}
+			bytes_recv += lens[i];
+			if (conn->m_state != NetConnectState::NET_CONN_CONNECTED) continue;
+			//当前帧指向第i个数据报
+			conn->m_recv_pos = i * size;
+			conn->m_recv_buf = base + conn->m_recv_pos;
+			conn->m_recv_buf_len = cap - conn->m_recv_pos;
+			conn->m_recv_len = lens[i];
+			conn->m_peer_addr = addrs[i];
+			process_net_msg(conn);
+#ifdef _ASYNCPP_DEBUG
+			//memory barrier
+			assert(memcmp(conn->m_recv_buf + conn->m_recv_buf_len + 16, "ASYNCPPMEMORYBAR", 16) == 0);
+#endif
+			conn->consume_recv(conn->m_recv_len);
+		}
+
+		if (n < _ASYNCPP_UDP_BATCH)
+		{ //未收满说明接收队列已空
+			conn->m_ready_events &= ~SELIN;
+			break;
+		}
+		if (conn->m_state != NetConnectState::NET_CONN_CONNECTED
+			|| bytes_recv + s.first >= m_recvspeedlimit)
+		{
+			break;
+		}
+	}
+	conn->release_recv_buffer(cap);
 	return bytes_recv;
 }
 
+uint32_t NetBaseThread::do_send_dgram(NetConnect* conn)
+{
+	struct iovec iov[_ASYNCPP_UDP_BATCH];
+	struct sockaddr_in addrs[_ASYNCPP_UDP_BATCH];
+	uint32_t bytes_sent = 0;
+	const auto& s = m_ss.get_cur_speed();
+	if (s.second >= m_sendspeedlimit) return 0;
+
+	while (!conn->m_send_list.empty())
+	{
+		//数据报不能部分发送，限速时按个数截断
+		int32_t cnt = 0;
+		uint32_t try_send = 0;
+		for (auto it = conn->m_send_list.begin();
+			it != conn->m_send_list.end() && cnt < _ASYNCPP_UDP_BATCH; ++it)
+		{
+			if (cnt > 0 && try_send + it->data_len + bytes_sent + s.second > m_sendspeedlimit) break;
+			iov[cnt].iov_base = it->data;
+			iov[cnt].iov_len = it->data_len;
+			unpack_peer(it->peer, addrs[cnt]);
+			try_send += it->data_len;
+			++cnt;
+		}
+
+		int32_t n = send_dgrams(conn->m_fd, iov, addrs, cnt);
+		if (n >= 0)
+		{
+			_DEBUGLOG(logger, "sockfd:%d send %d/%d datagrams", conn->m_fd, n, cnt);
+			for (int32_t i = 0; i < n; ++i)
+			{
+				SendMsgType& msg = conn->m_send_list.front();
+				bytes_sent += msg.data_len;
+				msg.release();
+				conn->m_send_list.pop_front();
+			}
+			if (bytes_sent + s.second >= m_sendspeedlimit) break;
+		}
+		else
+		{
+			int32_t errcode = GET_SOCK_ERR();
+			if (errcode == WSAEWOULDBLOCK || errcode == EAGAIN)
+			{ //发送缓冲区已满，等待下一次可写事件
+				conn->m_ready_events &= ~SELOUT;
+				break;
+			}
+			else if (errcode != WSAEINTR)
+			{ //丢弃出错的数据报(过长、目的地址不可达等)，不影响后面的数据报
+				SendMsgType& msg = conn->m_send_list.front();
+				_WARNLOG(logger, "sockfd:%d drop %uB datagram, error:%d[%s]", conn->m_fd, msg.data_len, errcode, strerror(errno));
+				msg.release();
+				conn->m_send_list.pop_front();
+			}
+		}
+	}
+
+	if (conn->m_send_list.empty()) set_read_event(conn);
+	return bytes_sent;
+}
+
+int32_t NetBaseThread::send_to(NetConnect* conn, const struct sockaddr_in& addr,
+	char* msg, uint32_t msg_len, MsgBufferType buf_type)
+{
+	if (!conn->m_dgram || conn->m_state != NetConnectState::NET_CONN_CONNECTED)
+	{
+		_WARNLOG(logger, "conn %d not datagram or error state:%d", (int)conn->m_fd, (int)conn->m_state);
+		assert(0);
+		return EINVAL;
+	}
+	_DEBUGLOG(logger, "conn %d send_to %uB", (int)conn->m_fd, msg_len);
+	if (conn->m_send_list.empty())
+	{
+		set_rdwr_event(conn);
+	}
+	return conn->send_to(pack_peer(addr), msg, msg_len, buf_type);
+}
+
 int32_t NetBaseThread::set_sock_nonblock(SOCKET_HANDLE fd)
 {
 #ifdef _WIN32
@@ -455,13 +1334,40 @@ int32_t NetBaseThread::set_sock_cloexec(SOCKET_HANDLE fd)
 	return  ret == 0 ? 0 : GET_SOCK_ERR();
 }
 
-SOCKET_HANDLE NetBaseThread::create_tcp_socket(bool nonblock)
+int32_t NetBaseThread::set_sock_busy_poll(SOCKET_HANDLE fd)
+{
+	if (m_sock_busy_poll_us == 0) return 0;
+#if defined(__linux__) && defined(SO_BUSY_POLL)
+	int val = static_cast<int>(m_sock_busy_poll_us);
+	int ret = setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &val, sizeof val);
+	if (ret != 0)
+	{
+		_WARNLOG(logger, "sockfd:%d set SO_BUSY_POLL fail:%d[%s]", fd, errno, strerror(errno));
+		return GET_SOCK_ERR();
+	}
+	if (m_prefer_busy_poll)
+	{
+		val = 1;
+		ret = setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &val, sizeof val);
+		if (ret != 0)
+		{
+			_WARNLOG(logger, "sockfd:%d set SO_PREFER_BUSY_POLL fail:%d[%s]", fd, errno, strerror(errno));
+			return GET_SOCK_ERR();
+		}
+	}
+	return 0;
+#else
+	return ENOTSUP;
+#endif
+}
+
+SOCKET_HANDLE NetBaseThread::create_tcp_socket(bool nonblock, int family)
 {
 #ifdef SOCK_NONBLOCK
-	return socket(AF_INET, 
+	return socket(family, 
 		nonblock ? SOCK_STREAM|SOCK_NONBLOCK : SOCK_STREAM, 0);
 #else
-	SOCKET_HANDLE fd = socket(AF_INET, SOCK_STREAM, 0);
+	SOCKET_HANDLE fd = socket(family, SOCK_STREAM, 0);
 	if (nonblock)
 	{
 		int ret = set_sock_nonblock(fd);
@@ -476,35 +1382,165 @@ SOCKET_HANDLE NetBaseThread::create_tcp_socket(bool nonblock)
 #endif
 }
 
+/*
+ 解析监听或连接的地址
+ "unix:/path"为Unix域socket，"unix:@name"为抽象命名空间(仅Linux)，否则为ipv4地址
+ @return 0成功，EINVAL地址不合法
+*/
+static int32_t parse_sock_addr(const char* ip, uint16_t port,
+	struct sockaddr_storage& addr, socklen_t& addrlen)
+{
+	memset(&addr, 0, sizeof addr);
+	if (is_str_unix(ip))
+	{
+#ifdef _WIN32
+		return EINVAL;
+#else
+		auto un = reinterpret_cast<struct sockaddr_un*>(&addr);
+		const char* path = ip + 5;
+		size_t len = strlen(path);
+		if (len == 0 || len >= sizeof un->sun_path) return EINVAL;
+		un->sun_family = AF_UNIX;
+		memcpy(un->sun_path, path, len);
+		if (path[0] == '@')
+		{ //抽象地址以'\0'开头，长度不含结尾的'\0'
+			un->sun_path[0] = '\0';
+			addrlen = static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + len);
+		}
+		else addrlen = static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + len + 1);
+		return 0;
+#endif
+	}
+	auto in = reinterpret_cast<struct sockaddr_in*>(&addr);
+	in->sin_family = AF_INET;
+	in->sin_port = htons(port);
+	//@return 0 if ip invalid, -1 if error occur
+	if (asyncpp_inet_pton(AF_INET, ip, reinterpret_cast<void*>(&in->sin_addr)) != 1) return EINVAL;
+	addrlen = sizeof *in;
+	return 0;
+}
+
 std::pair<int32_t, SOCKET_HANDLE>
 NetBaseThread::create_listen_socket(const char* ip, uint16_t port,
 	thread_pool_id_t client_thread_pool, thread_id_t client_thread,
-	bool nonblock)
+	bool nonblock, int32_t backlog, uint32_t defer_accept)
 {
-	int ret = 0;
-	struct sockaddr_in addr = {};
+	return open_listen_socket(ip, port, client_thread_pool, client_thread,
+		nonblock, ReusePortMode::NONE, 0, backlog, defer_accept);
+}
 
-	addr.sin_family = AF_INET;
-	addr.sin_port = htons(port);
-	ret = asyncpp_inet_pton(AF_INET, ip, reinterpret_cast<void*>(&addr.sin_addr));
-	if (ret != 1) return {EINVAL,INVALID_SOCKET}; //@return 0 if ip invalid, -1 if error occur
+/*
+ reuseport组按CPU选择监听socket：返回CPU号模group，即组内第几个socket
+*/
+static int32_t attach_reuseport_cpu(SOCKET_HANDLE fd, uint32_t group)
+{
+#ifdef _ASYNCPP_REUSEPORT_CBPF
+	struct sock_filter code[] = {
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU) },
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, group },
+		{ BPF_RET | BPF_A, 0, 0, 0 },
+	};
+	struct sock_fprog prog;
+	prog.len = sizeof code / sizeof code[0];
+	prog.filter = code;
+	if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof prog) != 0)
+	{
+		return errno;
+	}
+	return 0;
+#else
+	return ENOTSUP;
+#endif
+}
+
+std::pair<int32_t, SOCKET_HANDLE>
+NetBaseThread::open_listen_socket(const char* ip, uint16_t port,
+	thread_pool_id_t client_thread_pool, thread_id_t client_thread,
+	bool nonblock, ReusePortMode reuseport, uint32_t group,
+	int32_t backlog, uint32_t defer_accept)
+{
+	int ret = 0;
+	struct sockaddr_storage addr;
+	socklen_t addrlen = 0;
+	if (parse_sock_addr(ip, port, addr, addrlen) != 0) return {EINVAL,INVALID_SOCKET};
+#ifndef SO_REUSEPORT
+	if (reuseport != ReusePortMode::NONE) return {ENOTSUP,INVALID_SOCKET};
+#endif
+	if (reuseport != ReusePortMode::NONE && addr.ss_family != AF_INET) return {EINVAL,INVALID_SOCKET};
 
-	SOCKET_HANDLE fd = create_tcp_socket(nonblock);
+	SOCKET_HANDLE fd = create_tcp_socket(nonblock, addr.ss_family);
 	assert(fd != INVALID_SOCKET);
 	if (fd == INVALID_SOCKET)
 		return std::make_pair(GET_SOCK_ERR(), fd);
 
-	int32_t bReuse = 1;
-	ret = setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, 
-		reinterpret_cast<char*>(&bReuse), sizeof bReuse);
-	assert(ret == 0);
+	if (addr.ss_family == AF_INET)
+	{
+		int32_t bReuse = 1;
+		ret = setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, 
+			reinterpret_cast<char*>(&bReuse), sizeof bReuse);
+		assert(ret == 0);
+#ifdef SO_REUSEPORT
+		if (reuseport != ReusePortMode::NONE)
+		{
+			ret = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT,
+				reinterpret_cast<char*>(&bReuse), sizeof bReuse);
+			if (ret != 0) goto L_ERR;
+		}
+#endif
+		if (defer_accept != 0)
+		{ //连接上收到数据后才通知accept
+#ifdef TCP_DEFER_ACCEPT
+			int32_t secs = static_cast<int32_t>(defer_accept);
+			if (setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+				reinterpret_cast<char*>(&secs), sizeof secs) != 0)
+			{
+				_WARNLOG(logger, "sockfd:%d set TCP_DEFER_ACCEPT fail:%d[%s]", (int)fd, errno, strerror(errno));
+			}
+#else
+			_WARNLOG(logger, "sockfd:%d TCP_DEFER_ACCEPT not supported", (int)fd);
+#endif
+		}
+	}
+#ifndef _WIN32
+	else
+	{ //删除上次运行残留的socket文件，否则bind返回EADDRINUSE
+		auto un = reinterpret_cast<const struct sockaddr_un*>(&addr);
+		struct stat st;
+		if (un->sun_path[0] != '\0' && stat(un->sun_path, &st) == 0 && S_ISSOCK(st.st_mode))
+		{ //只有连接被拒绝(没有进程在监听)时才是残留文件
+			SOCKET_HANDLE probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+			if (probe != INVALID_SOCKET)
+			{
+				set_sock_nonblock(probe);
+				if (::connect(probe, reinterpret_cast<const struct sockaddr*>(&addr), addrlen) != 0
+					&& GET_SOCK_ERR() == ECONNREFUSED)
+				{
+					unlink(un->sun_path);
+				}
+				else
+				{
+					_WARNLOG(logger, "%s is in use", un->sun_path);
+				}
+				::closesocket(probe);
+			}
+		}
+	}
+#endif
 
-	ret = ::bind(fd, reinterpret_cast<const struct sockaddr*>(&addr), sizeof addr);
+	ret = ::bind(fd, reinterpret_cast<const struct sockaddr*>(&addr), addrlen);
 	if (ret != 0) goto L_ERR;
 
-	ret = listen(fd, 100);
+	ret = listen(fd, backlog);
 	if (ret == 0)
 	{
+		if (reuseport == ReusePortMode::CPU)
+		{ //组内每加入一个socket都以新的组大小重新设置
+			ret = attach_reuseport_cpu(fd, group);
+			if (ret != 0)
+			{
+				_WARNLOG(logger, "sockfd:%d attach reuseport cbpf fail:%d[%s], fallback to hash", (int)fd, ret, strerror(ret));
+			}
+		}
 		NetConnect conn(fd, client_thread_pool, client_thread);
 		add_conn(&conn);
 		return std::make_pair(0, fd);
@@ -520,26 +1556,75 @@ L_ERR:
 	return std::make_pair(ret, fd);
 }
 
+void NetBaseThread::listen_reuseport(ThreadMsg& msg)
+{
+	auto ctx = (AddListenerCtx*)msg.m_ctx.obj;
+	uint32_t group = static_cast<uint32_t>(get_thread_pool()->get_threads().size());
+	if (ctx->m_reuseport_fds.size() <= get_id())
+	{
+		const auto& r = open_listen_socket(msg.m_buf, ctx->m_port,
+			get_thread_pool_id(), get_id(), true, ctx->m_reuseport, get_id() + 1u,
+			ctx->m_backlog, ctx->m_defer_accept);
+		ctx->m_ret = r.first;
+		ctx->m_connid = static_cast<uint32_t>(r.second);
+		_DEBUGLOG(logger, "reuseport listen %s:%u, thread %u/%u, result:%d",
+			msg.m_buf, ctx->m_port, get_id(), group, r.first);
+
+		if (r.first == 0)
+		{
+			ctx->m_reuseport_fds.push_back(r.second);
+			if (get_id() + 1u < group)
+			{ //按线程顺序加入reuseport组，第k个socket属于第k个线程
+				ThreadMsg fwd(std::move(msg));
+				fwd.m_dst_thread_id = get_id() + 1;
+				if (get_asynframe()->send_thread_msg(std::move(fwd), true)) return;
+				ctx->m_ret = EBUSY;
+				msg = std::move(fwd);
+			}
+		}
+	}
+
+	if (ctx->m_ret != 0 && !ctx->m_reuseport_fds.empty())
+	{ //有线程出错，按相反顺序关闭已建立的监听后再回复
+		if (ctx->m_reuseport_fds.size() == get_id() + 1u)
+		{
+			NetConnect* conn = get_conn(static_cast<uint32_t>(ctx->m_reuseport_fds.back()));
+			if (conn != nullptr) remove_conn(conn);
+			ctx->m_reuseport_fds.pop_back();
+		}
+		ctx->m_connid = static_cast<uint32_t>(INVALID_SOCKET);
+		if (!ctx->m_reuseport_fds.empty())
+		{
+			ThreadMsg fwd(std::move(msg));
+			fwd.m_dst_thread_id = get_id() - 1;
+			if (get_asynframe()->send_thread_msg(std::move(fwd), true)) return;
+			msg = std::move(fwd);
+			_WARNLOG(logger, "reuseport listen %s:%u rollback stopped at thread %u, %zu sockets left",
+				msg.m_buf, ctx->m_port, get_id(), ctx->m_reuseport_fds.size());
+		}
+	}
+	get_asynframe()->send_resp_msg(NET_LISTEN_ADDR_RESP,
+		nullptr, 0, MsgBufferType::STATIC, msg.m_ctx, msg.m_ctx_type, msg, this);
+	msg.detach_ctx();
+}
+
 std::pair<int32_t, SOCKET_HANDLE>
 NetBaseThread::create_connect_socket(const char* ip,
 	uint16_t port, bool nonblock, uint32_t seq)
 {
 	int ret = 0;
-	struct sockaddr_in addr = {};
-
-	addr.sin_family = AF_INET;
-	addr.sin_port = htons(port);
-	ret = asyncpp_inet_pton(AF_INET, ip, reinterpret_cast<void*>(&addr.sin_addr));
-	if (ret != 1) return {EINVAL,INVALID_SOCKET}; //@return 0 if ip invalid, -1 if error occur
+	struct sockaddr_storage addr;
+	socklen_t addrlen = 0;
+	if (parse_sock_addr(ip, port, addr, addrlen) != 0) return {EINVAL,INVALID_SOCKET};
 
-	SOCKET_HANDLE fd = create_tcp_socket(nonblock);
+	SOCKET_HANDLE fd = create_tcp_socket(nonblock, addr.ss_family);
 	assert(fd != INVALID_SOCKET);
 	if (fd == INVALID_SOCKET)
 		return std::make_pair(GET_SOCK_ERR(), fd);
 	for (;;)
 	{
 		ret = connect(fd,
-			reinterpret_cast<const struct sockaddr*>(&addr), sizeof addr);
+			reinterpret_cast<const struct sockaddr*>(&addr), addrlen);
 		if (ret == 0)
 		{
 			NetConnect conn(fd);
@@ -552,7 +1637,9 @@ NetBaseThread::create_connect_socket(const char* ip,
 		{
 			ret = GET_SOCK_ERR();
 			assert(ret != 0);
-			if (ret == WSAEWOULDBLOCK/*win*/ || ret == WSAEINPROGRESS/*linux*/)
+			//Unix域socket的connect不会进行中，EAGAIN表示对端的backlog已满
+			if ((ret == WSAEWOULDBLOCK/*win*/ || ret == WSAEINPROGRESS/*linux*/)
+				&& addr.ss_family == AF_INET)
 			{
 				NetConnect conn(fd, NetConnectState::NET_CONN_CONNECTING);
 				conn.m_ctx = seq;
@@ -574,6 +1661,58 @@ NetBaseThread::create_connect_socket(const char* ip,
 	return std::make_pair(ret, fd);
 }
 
+std::pair<int32_t, SOCKET_HANDLE>
+NetBaseThread::create_udp_socket(const char* ip,
+	uint16_t port, bool is_bind, uint32_t seq)
+{
+	int ret = 0;
+	struct sockaddr_in addr = {};
+
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	ret = asyncpp_inet_pton(AF_INET, ip, reinterpret_cast<void*>(&addr.sin_addr));
+	if (ret != 1) return {EINVAL,INVALID_SOCKET}; //@return 0 if ip invalid, -1 if error occur
+
+#ifdef SOCK_NONBLOCK
+	SOCKET_HANDLE fd = socket(AF_INET, SOCK_DGRAM|SOCK_NONBLOCK, 0);
+#else
+	SOCKET_HANDLE fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd != INVALID_SOCKET) set_sock_nonblock(fd);
+#endif
+	assert(fd != INVALID_SOCKET);
+	if (fd == INVALID_SOCKET)
+		return std::make_pair(GET_SOCK_ERR(), fd);
+
+	if (is_bind)
+	{
+		int32_t bReuse = 1;
+		ret = setsockopt(fd, SOL_SOCKET, SO_REUSEADDR,
+			reinterpret_cast<char*>(&bReuse), sizeof bReuse);
+		assert(ret == 0);
+		ret = ::bind(fd, reinterpret_cast<const struct sockaddr*>(&addr), sizeof addr);
+	}
+	else
+	{ //UDP的connect只记录对端地址，立刻完成
+		ret = connect(fd, reinterpret_cast<const struct sockaddr*>(&addr), sizeof addr);
+	}
+	if (ret == 0)
+	{
+		NetConnect conn(fd);
+		conn.m_ctx = seq;
+		conn.m_dgram = true;
+		add_conn(&conn);
+		_DEBUGLOG(logger, "udp %s, fd:%d", is_bind ? "bound" : "connected", fd);
+		return std::make_pair(0, fd);
+	}
+
+	ret = GET_SOCK_ERR();
+	assert(ret != 0);
+	_WARNLOG(logger, "sockfd:%d error:%d[%s]", (int)fd, ret, strerror(ret));
+	::closesocket(fd);
+	fd = INVALID_SOCKET;
+	return std::make_pair(ret, fd);
+}
+
 int32_t NetBaseThread::send_immediate(NetConnect* conn, char* msg, int32_t msg_len, int32_t wait_ms)
 {
 	int ret = 0;
@@ -593,7 +1732,7 @@ int32_t NetBaseThread::send_immediate(NetConnect* conn, char* msg, int32_t msg_l
 			if (errcode != WSAEWOULDBLOCK && errcode != EAGAIN && errcode != WSAEINTR)
 			{
 				///TODO: drop msg if fail several times
-				on_error_event(conn);
+				on_error_event(conn, errcode);
 				_WARNLOG(logger, "sockfd:%d error:%d[%s]", conn->m_fd, errcode, strerror(errno));
 				break;
 			}
@@ -605,7 +1744,7 @@ int32_t NetBaseThread::send_immediate(NetConnect* conn, char* msg, int32_t msg_l
 
 	if (bytes_sent > 0)
 	{
-		change_timer(conn->m_timerid, m_idle_timeout);
+		touch_idle_timer(conn);
 	}
 	return bytes_sent;
 }
@@ -623,10 +1762,15 @@ int32_t NetBaseThread::send_immediate(NetConnect* conn, char* msg, int32_t msg_l
 int32_t NetBaseThread::wait_msg(NetConnect* conn, int32_t wait_ms)
 {
 	uint32_t bytes_recv = 0;
-	int32_t len = conn->m_recv_buf_len - conn->m_recv_len;
 
 	for (;;)
 	{
+		int32_t len = conn->m_recv_buf_len - conn->m_recv_len;
+		if (len == 0)
+		{
+			conn->enlarge_recv_buffer();
+			len = conn->m_recv_buf_len - conn->m_recv_len;
+		}
 		int32_t recv_len = recv(conn->m_fd, conn->m_recv_buf + conn->m_recv_len, len, 0);
 
 		if (recv_len > 0)
@@ -635,7 +1779,7 @@ int32_t NetBaseThread::wait_msg(NetConnect* conn, int32_t wait_ms)
 			conn->m_recv_len += recv_len;
 			_DEBUGLOG(logger, "sockfd:%d recv %uB, total:%uB",
 				conn->m_fd, recv_len, conn->m_recv_len);
-			change_timer(conn->m_timerid, m_idle_timeout);
+			touch_idle_timer(conn);
 			int32_t package_len = frame(conn);
 			if (package_len <= conn->m_recv_len)
 			{ //recv one or more package
@@ -657,9 +1801,7 @@ int32_t NetBaseThread::wait_msg(NetConnect* conn, int32_t wait_ms)
 						//memory barrier
 						assert(memcmp(conn->m_recv_buf + conn->m_recv_buf_len + 16, "ASYNCPPMEMORYBAR", 16) == 0);
 #endif
-						memmove(conn->m_recv_buf,
-							conn->m_recv_buf + package_len, remain_len);
-						conn->m_recv_len = remain_len;
+						conn->consume_recv(package_len);
 						conn->m_header_len = 0;
 						conn->m_body_len = 0;
 						package_len = frame(conn);
@@ -698,7 +1840,7 @@ int32_t NetBaseThread::wait_msg(NetConnect* conn, int32_t wait_ms)
 			if (errcode != WSAEWOULDBLOCK && errcode != EAGAIN && errcode != WSAEINTR)
 			{
 				_WARNLOG(logger, "sockfd:%d error:%d[%s]", conn->m_fd, errcode, strerror(errno));
-				on_error_event(conn);
+				on_error_event(conn, errcode);
 				break;
 			}
 			if (wait_ms <= 0) break;
@@ -724,7 +1866,34 @@ uint32_t NetBaseThread::on_read_event(NetConnect* conn)
 		//non-blocking connect check write event
 		break;
 	case NetConnectState::NET_CONN_CLOSING:
-		//ignore
+		if (conn->m_zc_linger)
+		{ //等待零拷贝完成期间丢弃收到的数据，对端关闭或出错时不再等待
+			char buf[4096];
+			uint32_t bytes_recv = 0;
+			for (;;)
+			{
+				int32_t n = static_cast<int32_t>(::recv(conn->m_fd, buf, sizeof buf, 0));
+				if (n > 0)
+				{
+					bytes_recv += n;
+					continue;
+				}
+				int32_t errcode = n == 0 ? 0 : GET_SOCK_ERR();
+				if (errcode == WSAEINTR) continue;
+				if (errcode == WSAEWOULDBLOCK || errcode == EAGAIN)
+				{
+					conn->m_ready_events &= ~SELIN;
+				}
+				else
+				{
+					_INFOLOG(logger, "sockfd:%d closed while waiting zerocopy, %u msgs not confirmed",
+						conn->m_fd, conn->m_zc_list.size());
+					abort_zerocopy(conn);
+				}
+				break;
+			}
+			return bytes_recv;
+		}
 		break;
 	case NetConnectState::NET_CONN_CLOSED:
 		//ignore
@@ -756,7 +1925,7 @@ uint32_t NetBaseThread::on_write_event(NetConnect* conn)
 	{
 		uint32_t bytes_sent = 0;
 		if (!conn->m_send_list.empty()) bytes_sent = do_send(conn);
-		if (conn->m_send_list.empty()) remove_conn(conn);
+		if (conn->m_send_list.empty()) close_after_zerocopy(conn);
 		return bytes_sent;
 	}
 		break;
@@ -912,52 +2081,91 @@ int32_t NetBaseThread::frame(NetConnect* conn)
 
 void NetBaseThread::run()
 {
+	uint64_t spin_begin = 0; //开始连续空转的时刻，0表示未在空转
 	while (!get_asynframe()->end())
 	{
 		uint32_t thread_msg_cnt = check_timer_and_thread_msg();
+		uint64_t loop_begin = m_now_us;
 		uint32_t net_msg_cnt = poll();
-		if (thread_msg_cnt == 0 && net_msg_cnt == 0)
+		if (m_busy_poll_us == 0)
+		{
+			if (thread_msg_cnt == 0 && net_msg_cnt == 0)
+			{
+				idle();
+			}
+			continue;
+		}
+
+		//低延迟模式，统计耗时(只有本线程写，不需要原子加)
+		update_clock();
+		uint64_t cost = m_now_us - loop_begin;
+		if (thread_msg_cnt != 0 || net_msg_cnt != 0)
+		{
+			m_work_us.store(m_work_us.load(std::memory_order_relaxed) + cost,
+				std::memory_order_relaxed);
+			spin_begin = 0;
+			continue;
+		}
+		m_spin_us.store(m_spin_us.load(std::memory_order_relaxed) + cost,
+			std::memory_order_relaxed);
+		if (spin_begin == 0) spin_begin = loop_begin;
+		if (m_busy_poll_us == UINT32_MAX || m_now_us - spin_begin < m_busy_poll_us)
 		{
-			usleep(50 * 1000);
+			continue;
 		}
+
+		//超出空转预算，挂起直到有事件
+		spin_begin = 0;
+		uint64_t park_begin = m_now_us;
+		idle();
+		update_clock();
+		m_park_us.store(m_park_us.load(std::memory_order_relaxed) + m_now_us - park_begin,
+			std::memory_order_relaxed);
 	}
 }
 
 void NonblockNetThread::process_msg(ThreadMsg& msg)
 {
-	int ret = 0;
 	switch (msg.m_type)
 	{
 	case NET_ACCEPT_CLIENT_REQ:
-		if (m_conn.m_fd != INVALID_SOCKET)
-		{
-			ret = EINPROGRESS;
-		}
-		else
+	{
+		auto clients = reinterpret_cast<const AcceptedClient*>(msg.m_buf);
+		for (uint64_t i = 0; i < msg.m_ctx.i64; ++i)
 		{
-			auto fd = static_cast<SOCKET_HANDLE>(msg.m_ctx.i64);
-			ret = set_sock_nonblock(fd);
-			if ( ret == 0)
-			{ //do not send resp
-				m_conn = NetConnect(fd);
-				return; //NO resp on success
+			SOCKET_HANDLE fd = clients[i].fd;
+			int ret = 0;
+			if (m_conn.m_fd != INVALID_SOCKET)
+			{
+				ret = EINPROGRESS;
+			}
+			else
+			{
+#ifndef _ASYNCPP_ACCEPT4
+				ret = set_sock_nonblock(fd);
+#endif
+				if (ret == 0)
+				{ //do not send resp
+					m_conn = NetConnect(fd);
+					m_conn.m_peer_addr = clients[i].addr;
+					continue; //NO resp on success
+				}
 			}
+			_DEBUGLOG(logger, "reject client:%d, result:%d", (int)fd, ret);
+			get_asynframe()->send_resp_msg(NET_ACCEPT_CLIENT_RESP,
+				nullptr, 0, MsgBufferType::STATIC,
+				{static_cast<uint64_t>(ret) << 32 | static_cast<uint32_t>(fd)},
+				MsgContextType::STATIC, msg, this);
 		}
+	}
 		break;
 	default:
-		ret = EINVAL;
 		_WARNLOG(logger, "recv error msg:%u,"
 			" from %hu:%hu, to %hu:%hu", msg.m_type,
 			msg.m_src_thread_pool_id, msg.m_src_thread_id,
 			msg.m_dst_thread_pool_id, msg.m_dst_thread_id);
-		return;
 		break;
 	}
-	_DEBUGLOG(logger, "reject client:%" PRIu64 ", result:%d", msg.m_ctx.i64, ret);
-	get_asynframe()->send_resp_msg(NET_ACCEPT_CLIENT_RESP,
-		nullptr, 0, MsgBufferType::STATIC,
-		{static_cast<uint64_t>(ret) << 32 | m_conn.m_fd},
-		MsgContextType::STATIC, msg, this);
 }
 
 void NonblockConnectThread::process_msg(ThreadMsg& msg)
@@ -973,10 +2181,14 @@ void NonblockConnectThread::process_msg(ThreadMsg& msg)
 		else
 		{
 			char ip[MAX_IP];
-			ctx->m_ret = dns_query(msg.m_buf, ip);
+			bool is_unix = is_str_unix(msg.m_buf) != 0;
+			ctx->m_ret = is_unix ? 0 : dns_query(msg.m_buf, ip);
 			if (ctx->m_ret == 0)
 			{
-				const auto& r = create_connect_socket(ip, ctx->m_port, true, ctx->m_seq);
+				const char* addr = is_unix ? msg.m_buf : ip;
+				const auto& r = ctx->m_sock_type == SOCK_DGRAM
+					? create_udp_socket(addr, ctx->m_port, false, ctx->m_seq)
+					: create_connect_socket(addr, ctx->m_port, true, ctx->m_seq);
 				assert(r.first == 0);
 				ctx->m_ret = r.first;
 				ctx->m_connid = static_cast<uint32_t>(r.second);
@@ -1006,11 +2218,17 @@ void NonblockListenThread::process_msg(ThreadMsg& msg)
 	case NET_LISTEN_ADDR_REQ:
 	{
 		auto ctx = (AddListenerCtx*)msg.m_ctx.obj;
-		const auto& r = create_listen_socket(msg.m_buf,
-			ctx->m_port, ctx->m_client_thread_pool_id,
-			ctx->m_client_thread_id);
+		const auto& r = ctx->m_sock_type == SOCK_DGRAM
+			? create_udp_socket(msg.m_buf, ctx->m_port, true, ctx->m_seq)
+			: create_listen_socket(msg.m_buf,
+				ctx->m_port, ctx->m_client_thread_pool_id,
+				ctx->m_client_thread_id, true, ctx->m_backlog, ctx->m_defer_accept);
 		ctx->m_ret = r.first;
 		ctx->m_connid = static_cast<uint32_t>(r.second);
+		if (r.first == 0 && ctx->m_sock_type != SOCK_DGRAM)
+		{
+			get_conn(ctx->m_connid)->m_placement = ctx->m_placement;
+		}
 		_DEBUGLOG(logger, "%s, result:%d", msg.m_buf, ctx->m_ret);
 		get_asynframe()->send_resp_msg(NET_LISTEN_ADDR_RESP,
 			msg.m_buf, msg.m_buf_len, msg.m_buf_type,
@@ -1035,6 +2253,11 @@ void NonblockListenThread::process_msg(ThreadMsg& msg)
 	}
 }
 
+int32_t is_str_unix(const char* addr)
+{
+	return strncmp(addr, "unix:", 5) == 0 ? 1 : 0;
+}
+
 int32_t is_str_ipv4(const char* ipv4str)
 {
 	if (!isdigit(*ipv4str)) return 0;
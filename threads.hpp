@@ -3,7 +3,11 @@
 
 #include "asyncommon.hpp"
 #include "pqueue.hpp"
+#include "ringqueue.hpp"
+#include "timerwheel.hpp"
+#include "clock.hpp"
 #include "syncqueue.hpp"
+#include "notifier.hpp"
 #include "selector.hpp"
 #include "byteorder.h"
 #include <stdio.h>
@@ -25,6 +29,34 @@
 #define _ASYNCPP_THREAD_POOL_QUEUE_SIZE 1024
 #endif
 
+#ifndef _ASYNCPP_THREAD_STEAL_QUEUE_SIZE
+#define _ASYNCPP_THREAD_STEAL_QUEUE_SIZE 256
+#endif
+
+#ifndef _ASYNCPP_SEND_IOV_MAX
+#define _ASYNCPP_SEND_IOV_MAX 64 //do_send每次合并发送的最大消息数，不超过IOV_MAX
+#endif
+
+#ifndef _ASYNCPP_SEND_FILE_CHUNK
+#define _ASYNCPP_SEND_FILE_CHUNK 0x40000000u //send_file时每个队列项最多发送的字节数
+#endif
+
+#ifndef _ASYNCPP_RECV_POOL_LIMIT
+#define _ASYNCPP_RECV_POOL_LIMIT (64u << 20) //每个线程的接收缓冲区池最多缓存的字节数
+#endif
+
+#ifndef _ASYNCPP_RECV_POOL_MAX_BUF
+#define _ASYNCPP_RECV_POOL_MAX_BUF (4 << 20) //超过该长度的接收缓冲区不缓存，用完直接释放
+#endif
+
+#ifndef _ASYNCPP_UDP_BATCH
+#define _ASYNCPP_UDP_BATCH 16 //UDP每次系统调用最多收发的数据报数
+#endif
+
+#ifndef _ASYNCPP_UDP_DGRAM_SIZE
+#define _ASYNCPP_UDP_DGRAM_SIZE 65536 //接收时为每个数据报预留的长度，更长的数据报被丢弃
+#endif
+
 #ifndef _ASYNCPP_DNS_TIMEOUT
 #define _ASYNCPP_DNS_TIMEOUT 3600 //s
 #endif
@@ -37,6 +69,26 @@
 #define _ASYNCPP_IDLE_TIMEOUT 3600 //s
 #endif
 
+#ifndef _ASYNCPP_PIPE_RETRY_US
+#define _ASYNCPP_PIPE_RETRY_US 1000 //send_file的管道暂时没有数据时，多少微秒后重试
+#endif
+
+#ifndef _ASYNCPP_ZEROCOPY_LINGER
+#define _ASYNCPP_ZEROCOPY_LINGER 10 //s，close()的连接发送完后等待零拷贝完成通知的最长时间
+#endif
+
+#ifndef _ASYNCPP_LISTEN_BACKLOG
+#define _ASYNCPP_LISTEN_BACKLOG 100 //监听socket默认的backlog
+#endif
+
+#ifndef _ASYNCPP_ACCEPT_BATCH
+#define _ASYNCPP_ACCEPT_BATCH 32 //accept的连接合并为一个消息转交给处理线程时，每个消息最多包含的连接数
+#endif
+
+#if defined(__linux__) && !defined(_DISABLE_ACCEPT4)
+#define _ASYNCPP_ACCEPT4 //accept4直接得到非阻塞、close-on-exec的socket，不再调用fcntl
+#endif
+
 #ifdef _WIN32
 #pragma warning(disable:4100)
 #endif
@@ -44,6 +96,24 @@
 namespace asyncpp
 {
 
+/*
+ 线程消息队列，默认使用无锁MPSC队列
+ 定义_ASYNCPP_THREAD_QUEUE_SPINLOCK则使用基于自旋锁的FixedSizeCircleQueue
+*/
+#ifdef _ASYNCPP_THREAD_QUEUE_SPINLOCK
+typedef FixedSizeCircleQueue<ThreadMsg, _ASYNCPP_THREAD_QUEUE_SIZE> ThreadMsgQueue;
+#else
+typedef MpscBoundedQueue<ThreadMsg, _ASYNCPP_THREAD_QUEUE_SIZE> ThreadMsgQueue;
+#endif
+
+/*
+ 工作窃取模式下每个线程的本地队列
+ ThreadWorkDeque: 本线程投递的线程组消息，兄弟线程空闲时从这里批量窃取
+ ThreadWorkInbox: 其它线程投递的线程组消息，由本线程转入ThreadWorkDeque
+*/
+typedef WorkStealingDeque<ThreadMsg, _ASYNCPP_THREAD_STEAL_QUEUE_SIZE> ThreadWorkDeque;
+typedef MpscBoundedQueue<ThreadMsg, _ASYNCPP_THREAD_QUEUE_SIZE> ThreadWorkInbox;
+
 enum class ThreadState : uint8_t
 {
 	INIT,
@@ -57,10 +127,15 @@ class ThreadPool;
 class BaseThread
 {
 protected:
-	FixedSizeCircleQueue<ThreadMsg, _ASYNCPP_THREAD_QUEUE_SIZE> m_msg_queue;
+	ThreadMsgQueue m_msg_queue;
 	pqueue<TimerMsg> m_timer;
+	TimerWheel* m_timer_wheel; //非空时使用时间轮代替m_timer
+	uint64_t m_now_us; //本线程缓存的单调时钟，每轮循环更新一次
 	std::unordered_map<uint64_t, MsgContext*> m_ctxs;
 	ThreadMsg m_msg_cache[_ASYNCPP_THREAD_MSG_CACHE_SIZE];
+	ThreadNotifier m_notifier;
+	ThreadWorkDeque* m_work_deque;
+	ThreadWorkInbox* m_work_inbox;
 	ThreadPool* m_master;
 	std::thread* m_thr;
 	thread_id_t m_id;
@@ -69,8 +144,13 @@ public:
 	BaseThread()
 		: m_msg_queue()
 		, m_timer()
+		, m_timer_wheel(nullptr)
+		, m_now_us(monotonic_us())
 		, m_ctxs()
 		, m_msg_cache()
+		, m_notifier()
+		, m_work_deque(nullptr)
+		, m_work_inbox(nullptr)
 		, m_master(nullptr)
 		, m_thr(nullptr)
 		, m_id(0)
@@ -80,8 +160,13 @@ public:
 	BaseThread(ThreadPool* threadpool)
 		: m_msg_queue()
 		, m_timer()
+		, m_timer_wheel(nullptr)
+		, m_now_us(monotonic_us())
 		, m_ctxs()
 		, m_msg_cache()
+		, m_notifier()
+		, m_work_deque(nullptr)
+		, m_work_inbox(nullptr)
 		, m_master(threadpool)
 		, m_thr(nullptr)
 		, m_id(0)
@@ -91,6 +176,9 @@ public:
 	virtual ~BaseThread()
 	{
 		for (auto& it : m_ctxs)delete it.second;
+		delete m_work_deque;
+		delete m_work_inbox;
+		delete m_timer_wheel;
 	}
 	BaseThread(const BaseThread&) = delete;
 	BaseThread& operator=(const BaseThread&) = delete;
@@ -107,6 +195,34 @@ public:
 	
 	uint32_t check_timer_and_thread_msg();
 
+	/*
+	 本线程缓存的单调时钟(us)，定时器均以此为基准
+	 每轮check_timer_and_thread_msg()及挂起前后更新，同一轮循环内读取无系统调用
+	*/
+	uint64_t now_us() const { return m_now_us; }
+	uint64_t update_clock() { return m_now_us = monotonic_us(); }
+
+	/*
+	 工作窃取模式下处理线程组消息：收件箱 -> 本地队列 -> 共享队列 -> 窃取兄弟线程
+	*/
+	uint32_t check_work_msg();
+
+	/*
+	 当前系统线程对应的BaseThread，非框架线程返回nullptr
+	*/
+	static BaseThread* current();
+	static void set_current(BaseThread* t);
+
+	/*
+	 是否有待处理的线程消息(包括所属线程组的消息队列)
+	*/
+	bool has_pending_msg() const;
+
+	/*
+	 无任务时调用，挂起直到有新消息、被唤醒或下一个定时器到期
+	*/
+	void idle();
+
 	virtual void on_start(){}
 
 	/*
@@ -114,6 +230,23 @@ public:
 	*/
 	virtual void run();
 
+	/*
+	 挂起线程，直到被wakeup()或超时
+	 @param timeout_us <0表示一直等待
+	 重写这个函数以改变等待方式，如在selector上等待
+	*/
+	virtual void park(int64_t timeout_us)
+	{
+		m_notifier.park(timeout_us);
+	}
+
+	/*
+	 唤醒挂起中的线程，线程未挂起时没有额外开销
+	 @return true表示本次调用唤醒了线程
+	*/
+	bool wakeup() { return m_notifier.notify(); }
+	bool parked() const { return m_notifier.parked(); }
+
 	/*
 	 重写这个函数以处理线程消息
 	*/
@@ -133,7 +266,12 @@ public:
 	*/
 	bool push_msg(ThreadMsg&& msg)
 	{
-		return m_msg_queue.push(std::move(msg));
+		if (m_msg_queue.push(std::move(msg)))
+		{
+			m_notifier.notify();
+			return true;
+		}
+		else return false;
 	}
 	bool full() const { return m_msg_queue.full(); }
 	uint32_t get_queued_msg_number()
@@ -141,7 +279,74 @@ public:
 		return m_msg_queue.size();
 	}
 
+	/*
+	 设置消息队列容量，overflow为true时队列满后的消息存入溢出段，不会发送失败
+	 只能在线程启动前调用，队列中已有的消息会被丢弃
+	*/
+	void set_msg_queue_size(uint32_t size, bool overflow = false)
+	{
+		m_msg_queue.resize(size, overflow);
+	}
+	uint32_t get_msg_queue_capacity() const { return m_msg_queue.capacity(); }
+
+	/*
+	 开启/关闭工作窃取所需的本地队列，由所属ThreadPool在线程启动前调用
+	*/
+	void enable_work_stealing(bool enable)
+	{
+		delete m_work_deque;
+		delete m_work_inbox;
+		m_work_deque = enable ? new ThreadWorkDeque() : nullptr;
+		m_work_inbox = enable ? new ThreadWorkInbox() : nullptr;
+	}
+	bool work_stealing() const { return m_work_deque != nullptr; }
+
+	/*
+	 将线程组消息放入本地队列，只能在本线程内调用
+	*/
+	bool push_local_msg(ThreadMsg&& msg)
+	{
+		return m_work_deque->push(std::move(msg));
+	}
+
+	/*
+	 将线程组消息放入本线程的收件箱，可在任意线程调用
+	*/
+	bool push_inbox_msg(ThreadMsg&& msg)
+	{
+		if (m_work_inbox->push(std::move(msg)))
+		{
+			m_notifier.notify();
+			return true;
+		}
+		else return false;
+	}
+
+	/*
+	 从本地队列顶部批量窃取消息，可在任意线程调用
+	*/
+	uint32_t steal_msg(ThreadMsg* msg, uint32_t n)
+	{
+		return m_work_deque->steal(msg, n);
+	}
+
+	/*
+	 本地待处理的线程组消息数，用于选择负载最低的线程
+	*/
+	uint32_t get_local_load() const
+	{
+		return m_work_deque->size() + m_work_inbox->size();
+	}
+	/*
+	 本地队列中是否有可被窃取的消息，收件箱中的消息不能被窃取
+	*/
+	bool has_stealable_msg() const
+	{
+		return !m_work_deque->empty();
+	}
+
 	/*遍历消息队列,返回删除的消息个数
+	使用无锁队列时只能在本线程内调用
 	int32_t callback(ThreadMsg& v, void*);
 	return 0 -> ignore
 	       1 -> remove the element
@@ -156,6 +361,19 @@ public:
 	*/
 	virtual void on_timer(uint32_t timerid, uint32_t type, uint64_t ctx){}
 
+	/*
+	 选择定时器实现，默认使用最小堆
+	 时间轮的增删改为O(1)，适合连接数多、频繁修改超时定时器的网络线程
+	 只能在添加定时器前调用
+	*/
+	void set_timer_wheel(bool enable)
+	{
+		assert(m_timer.empty() && (m_timer_wheel == nullptr || m_timer_wheel->empty()));
+		delete m_timer_wheel;
+		m_timer_wheel = enable ? new TimerWheel(m_now_us) : nullptr;
+	}
+	bool timer_wheel_enabled() const { return m_timer_wheel != nullptr; }
+
 	/*
 	 添加一个一次性定时器
 	 @param wait_time， 多少秒后定时器触发，可以为0(稍后触发)
@@ -163,22 +381,23 @@ public:
 	*/
 	int32_t add_timer(uint32_t wait_time, uint32_t type, uint64_t ctx)
 	{
-		uint32_t timerid = m_timer.push(TimerMsg(g_us_tick + wait_time * 1000000ull, ctx, type));
-		_INFOLOG(logger, "timerid:%u, wait_time:%us, g_us_tick:%" PRIu64
-			", type:%u, ctx:%" PRIu64, timerid, wait_time, g_us_tick, type, ctx);
+		uint32_t timerid = push_timer(TimerMsg(m_now_us + wait_time * 1000000ull, ctx, type));
+		_INFOLOG(logger, "timerid:%u, wait_time:%us, now:%" PRIu64
+			", type:%u, ctx:%" PRIu64, timerid, wait_time, m_now_us, type, ctx);
 		return (int32_t)timerid;
 	}
 
 	/*
 	 添加一个一次性定时器
-	 @param wait_time_us， 多少微妙后定时器触发，可以为0(稍后触发)，目前最高精度为10ms级别
+	 @param wait_time_us， 多少微秒后定时器触发，可以为0(稍后触发)
+	 使用最小堆时精度为微秒级，使用时间轮时向上取整到_ASYNCPP_TIMER_WHEEL_TICK_US
 	 @return timerid: [0, INT32_MAX], always success except memory out
 	*/
 	int32_t add_timer_us(uint32_t wait_time_us, uint32_t type, uint64_t ctx)
 	{
-		uint32_t timerid = m_timer.push(TimerMsg(g_us_tick + wait_time_us, ctx, type));
-		_INFOLOG(logger, "timerid:%u, wait_time:%uus, g_us_tick:%" PRIu64
-			", type:%u, ctx:%" PRIu64, timerid, wait_time_us, g_us_tick, type, ctx);
+		uint32_t timerid = push_timer(TimerMsg(m_now_us + wait_time_us, ctx, type));
+		_INFOLOG(logger, "timerid:%u, wait_time:%uus, now:%" PRIu64
+			", type:%u, ctx:%" PRIu64, timerid, wait_time_us, m_now_us, type, ctx);
 		return (int32_t)timerid;
 	}
 
@@ -187,10 +406,11 @@ public:
 	*/
 	void del_timer(uint32_t timerid)
 	{
-		if (m_timer.is_index_valid(timerid))
+		if (is_timer_valid(timerid))
 		{
 			_INFOLOG(logger, "timerid:%u", timerid);
-			m_timer.remove(timerid);
+			if (m_timer_wheel != nullptr) m_timer_wheel->remove(timerid);
+			else m_timer.remove(timerid);
 		}
 		else
 		{
@@ -203,11 +423,10 @@ public:
 	*/
 	void change_timer(uint32_t timerid, uint32_t wait_time)
 	{
-		if (m_timer.is_index_valid(timerid))
+		if (is_timer_valid(timerid))
 		{
-			m_timer[timerid].m_expire_time = g_us_tick + wait_time * 1000000ull;
-			m_timer.change_priority(timerid);
-			_INFOLOG(logger, "timerid:%u, wait_time:%us, g_us_tick:%" PRIu64, timerid, wait_time, g_us_tick);
+			set_timer_expire_time(timerid, m_now_us + wait_time * 1000000ull);
+			_INFOLOG(logger, "timerid:%u, wait_time:%us, now:%" PRIu64, timerid, wait_time, m_now_us);
 		}
 		else
 		{
@@ -216,11 +435,10 @@ public:
 	}
 	void change_timer_us(uint32_t timerid, uint32_t wait_time_us)
 	{
-		if (m_timer.is_index_valid(timerid))
+		if (is_timer_valid(timerid))
 		{
-			m_timer[timerid].m_expire_time = g_us_tick + wait_time_us;
-			m_timer.change_priority(timerid);
-			_INFOLOG(logger, "timerid:%u, wait_time:%uus, g_us_tick:%" PRIu64, timerid, wait_time_us, g_us_tick);
+			set_timer_expire_time(timerid, m_now_us + wait_time_us);
+			_INFOLOG(logger, "timerid:%u, wait_time:%uus, now:%" PRIu64, timerid, wait_time_us, m_now_us);
 		}
 		else
 		{
@@ -228,11 +446,33 @@ public:
 		}
 	}
 
+	/*
+	 距离最近一个定时器到期的时间
+	 使用时间轮时为下一次需要转动时间轮的时间，可能早于实际到期时间
+	 @return us, -1表示没有定时器
+	*/
+	int64_t next_timer_wait_us() const
+	{
+		uint64_t expire;
+		if (m_timer_wheel != nullptr)
+		{
+			if (m_timer_wheel->empty()) return -1;
+			expire = m_timer_wheel->next_expire_time();
+		}
+		else
+		{
+			if (m_timer.empty()) return -1;
+			expire = m_timer.front().m_expire_time;
+		}
+		uint64_t cur = m_now_us;
+		return expire > cur ? static_cast<int64_t>(expire - cur) : 0;
+	}
+
 	const TimerMsg* get_timer(int32_t timerid) const
 	{
-		if (m_timer.is_index_valid(timerid))
+		if (is_timer_valid(timerid))
 		{
-			return &m_timer[timerid];
+			return m_timer_wheel != nullptr ? &(*m_timer_wheel)[timerid] : &m_timer[timerid];
 		}
 		else
 		{
@@ -247,7 +487,20 @@ public:
 	uint32_t timer_check()
 	{
 		uint32_t cnt = 0;
-		uint64_t cur = g_us_tick;
+		uint64_t cur = m_now_us;
+		if (m_timer_wheel != nullptr)
+		{
+			TimerMsg msg;
+			int32_t timerid;
+			m_timer_wheel->advance(cur);
+			while ((timerid = m_timer_wheel->pop_expired(msg)) >= 0)
+			{
+				++cnt;
+				_DEBUGLOG(logger, "run timerid:%d, type:%u, ctx:%" PRIu64, timerid, msg.m_type, msg.m_ctx);
+				on_timer(timerid, msg.m_type, msg.m_ctx);
+			}
+			return cnt;
+		}
 		while (!m_timer.empty())
 		{
 			const TimerMsg& front = m_timer.front();
@@ -267,6 +520,36 @@ public:
 		return cnt;
 	}
 
+private:
+	int32_t push_timer(TimerMsg&& msg)
+	{
+		if (m_timer_wheel != nullptr)
+		{
+			m_timer_wheel->sync(m_now_us);
+			return m_timer_wheel->push(std::move(msg));
+		}
+		return m_timer.push(std::move(msg));
+	}
+	bool is_timer_valid(int32_t timerid) const
+	{
+		return m_timer_wheel != nullptr
+			? m_timer_wheel->is_index_valid(timerid)
+			: m_timer.is_index_valid(timerid);
+	}
+	void set_timer_expire_time(int32_t timerid, uint64_t expire_time)
+	{
+		if (m_timer_wheel != nullptr)
+		{
+			(*m_timer_wheel)[timerid].m_expire_time = expire_time;
+			m_timer_wheel->change_priority(timerid);
+		}
+		else
+		{
+			m_timer[timerid].m_expire_time = expire_time;
+			m_timer.change_priority(timerid);
+		}
+	}
+
 public:
 	void add_thread_ctx(uint64_t seq, MsgContext* ctx)
 	{
@@ -320,6 +603,7 @@ enum NetTimerType
 {
 	NetTimeoutTimer = 10000,
 	NetBusyTimer,
+	NetPipeRetryTimer, //send_file的管道暂时没有数据，稍后重试
 };
 
 enum class NetMsgType : uint8_t
@@ -332,95 +616,360 @@ enum class NetMsgType : uint8_t
 	HTTP_RESP_CHUNKED,
 };
 
+//发送队列中消息的来源
+enum class SendMsgSource : uint8_t
+{
+	BUFFER, //data指向的缓冲区
+	FILE, //普通文件，使用sendfile从file_offset开始发送
+	PIPE, //管道，使用splice发送
+};
+
 struct SendMsgType
 {
 	char* data;
 	uint32_t data_len;
 	uint32_t bytes_sent;
 	MsgBufferType buf_type;
+	SendMsgSource source;
+	bool close_fd; //发送完毕后关闭file_fd
+	int32_t file_fd;
+	union
+	{
+		uint64_t file_offset;
+		uint64_t peer; //数据报的目的地址，s_addr << 16 | 端口(网络字节序)，0表示已connect的对端
+	};
+
+	void release()
+	{
+		if (source == SendMsgSource::BUFFER) free_buffer(data, buf_type);
+#ifndef _WIN32
+		else if (close_fd) ::close(file_fd);
+#endif
+	}
+};
+
+//已用MSG_ZEROCOPY发送完、等待内核释放页面的消息
+struct ZeroCopyMsg
+{
+	char* data;
+	uint32_t data_len;
+	uint32_t seq; //最后一次零拷贝发送的序号
+	MsgBufferType buf_type;
+};
+
+struct RecvPoolStat
+{
+	uint64_t m_cached_bytes; //池中空闲缓冲区的总长度
+	uint32_t m_cached_bufs;
+	uint32_t m_used_bufs; //连接正在使用的缓冲区
+	uint64_t m_used_bytes;
+	uint64_t m_hits; //从池中取得缓冲区的次数
+	uint64_t m_misses; //池中没有合适的缓冲区，新分配的次数
+};
+
+/*
+ 线程内的接收缓冲区池，按2的幂分级缓存空闲缓冲区
+ 缓冲区都以malloc(cap + 32)分配(多出的32字节用于_ASYNCPP_DEBUG的内存屏障)，取走后可直接free
+ 只能在所属线程内使用，统计值可在其他线程读取
+*/
+class RecvBufferPool
+{
+private:
+	enum : uint32_t
+	{
+		MIN_SHIFT = 9, //512B
+		CLASS_NUM = 32,
+	};
+	std::vector<char*> m_free_list[CLASS_NUM];
+	size_t m_limit;
+	std::atomic<uint64_t> m_cached_bytes;
+	std::atomic<uint32_t> m_cached_bufs;
+	std::atomic<uint32_t> m_used_bufs;
+	std::atomic<uint64_t> m_used_bytes;
+	std::atomic<uint64_t> m_hits;
+	std::atomic<uint64_t> m_misses;
+
+	//只有所属线程修改，不需要原子的读改写
+	template <typename T, typename V>
+	static void add(std::atomic<T>& a, V n)
+	{
+		a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+	static uint32_t class_of(int32_t n)
+	{
+		uint32_t shift = MIN_SHIFT;
+		while ((1u << shift) < static_cast<uint32_t>(n)) ++shift;
+		return shift;
+	}
+
+public:
+	RecvBufferPool()
+		: m_limit(_ASYNCPP_RECV_POOL_LIMIT)
+		, m_cached_bytes(0)
+		, m_cached_bufs(0)
+		, m_used_bufs(0)
+		, m_used_bytes(0)
+		, m_hits(0)
+		, m_misses(0)
+	{
+	}
+	~RecvBufferPool()
+	{
+		for (auto& l : m_free_list)
+		{
+			for (char* p : l) free(p);
+		}
+	}
+	RecvBufferPool(const RecvBufferPool&) = delete;
+	RecvBufferPool& operator=(const RecvBufferPool&) = delete;
+
+	/*
+	 取得至少n字节的缓冲区
+	 @param cap 缓冲区的实际长度，不超过_ASYNCPP_RECV_POOL_MAX_BUF时为2的幂
+	*/
+	char* alloc(int32_t n, int32_t& cap)
+	{
+		char* p;
+		if (n > _ASYNCPP_RECV_POOL_MAX_BUF)
+		{
+			cap = n;
+			p = static_cast<char*>(malloc(cap + 32));
+			add(m_misses, 1);
+		}
+		else
+		{
+			uint32_t cls = class_of(n);
+			cap = static_cast<int32_t>(1u << cls);
+			auto& l = m_free_list[cls];
+			if (!l.empty())
+			{
+				p = l.back();
+				l.pop_back();
+				add(m_cached_bytes, -static_cast<int64_t>(cap));
+				add(m_cached_bufs, -1);
+				add(m_hits, 1);
+			}
+			else
+			{
+				p = static_cast<char*>(malloc(cap + 32));
+				add(m_misses, 1);
+			}
+		}
+		assert(p != nullptr);
+		add(m_used_bufs, 1);
+		add(m_used_bytes, cap);
+		return p;
+	}
+	//归还alloc取得的缓冲区，cap为alloc返回的长度
+	void release(char* buf, int32_t cap)
+	{
+		add(m_used_bufs, -1);
+		add(m_used_bytes, -static_cast<int64_t>(cap));
+		if (cap <= _ASYNCPP_RECV_POOL_MAX_BUF && (cap & (cap - 1)) == 0
+			&& m_cached_bytes.load(std::memory_order_relaxed) + cap <= m_limit)
+		{
+			m_free_list[class_of(cap)].push_back(buf);
+			add(m_cached_bytes, cap);
+			add(m_cached_bufs, 1);
+		}
+		else free(buf);
+	}
+	//alloc取得的缓冲区被取走，由调用者free
+	void detach(int32_t cap)
+	{
+		add(m_used_bufs, -1);
+		add(m_used_bytes, -static_cast<int64_t>(cap));
+	}
+	//调整缓存上限，超出部分从大到小释放
+	void set_limit(size_t limit)
+	{
+		m_limit = limit;
+		for (uint32_t cls = CLASS_NUM; cls-- > MIN_SHIFT
+			&& m_cached_bytes.load(std::memory_order_relaxed) > m_limit; )
+		{
+			auto& l = m_free_list[cls];
+			while (!l.empty() && m_cached_bytes.load(std::memory_order_relaxed) > m_limit)
+			{
+				free(l.back());
+				l.pop_back();
+				add(m_cached_bytes, -(static_cast<int64_t>(1) << cls));
+				add(m_cached_bufs, -1);
+			}
+		}
+	}
+	size_t get_limit() const { return m_limit; }
+	RecvPoolStat get_stat() const
+	{
+		return RecvPoolStat{m_cached_bytes.load(std::memory_order_relaxed),
+			m_cached_bufs.load(std::memory_order_relaxed),
+			m_used_bufs.load(std::memory_order_relaxed),
+			m_used_bytes.load(std::memory_order_relaxed),
+			m_hits.load(std::memory_order_relaxed),
+			m_misses.load(std::memory_order_relaxed)};
+	}
+};
+
+/*
+ listener未指定处理线程时，accept的客户端在线程组中的分配方式
+ ANY以外的策略都由listener选定线程后直接发到该线程的消息队列
+*/
+enum class ClientPlacement : uint8_t
+{
+	ANY,			//交给线程组中先取到消息的线程
+	ROUND_ROBIN,	//依次轮流
+	LEAST_CONN,		//连接数最少的线程
+	LEAST_BYTES,	//上一秒收发字节数最少的线程
+	PEER_HASH,		//按对端ip哈希，同一ip总是交给同一线程
+};
+
+/*
+ accept得到的客户端，NET_ACCEPT_CLIENT_REQ中以数组形式转交给处理线程
+ 只保存ipv4的对端地址，其他地址族的addr.sin_family为0
+*/
+struct AcceptedClient
+{
+	SOCKET_HANDLE fd;
+	struct sockaddr_in addr;
 };
 
 struct NetConnect
 {
-	std::queue<SendMsgType> m_send_list;
+	ringqueue<SendMsgType> m_send_list; //空闲连接不分配内存
+	ringqueue<ZeroCopyMsg, 2> m_zc_list; //等待零拷贝完成通知的消息
 	uint64_t m_ctx;
+	uint64_t m_last_active_us; //最近一次收发数据的时间，用于延迟检查空闲超时
+	//接收缓冲区，m_recv_buf指向当前帧(第一个未处理的字节)，处理完一帧后后移，不搬移数据
 	char* m_recv_buf;
-	int32_t m_recv_len;
-	int32_t m_recv_buf_len;
+	int32_t m_recv_len; //从m_recv_buf开始已收到的字节数
+	int32_t m_recv_buf_len; //从m_recv_buf开始的容量
+	int32_t m_recv_pos; //m_recv_buf相对于缓冲区起始地址的偏移
+	int32_t m_recv_hint; //下次从池中取缓冲区时的长度，按上次的用量调整
+	RecvBufferPool* m_recv_pool; //所属线程的缓冲区池，nullptr时直接realloc
 	int32_t m_header_len;
 	int32_t m_body_len;
 	SOCKET_HANDLE m_fd;
 	int32_t m_timerid;
+	int32_t m_pipe_timerid; //send_file的管道暂时没有数据时的重试定时器，-1表示没有
 	//int32_t m_busytimerid;
 	//bool m_busy;
 	thread_pool_id_t m_client_thread_pool; //for listen socket only
 	thread_id_t m_client_thread; //for listen socket only
+	ClientPlacement m_placement; //for listen socket only
 	NetConnectState m_state;
 	NetMsgType m_net_msg_type;
+	uint8_t m_ready_events; //已就绪但尚未处理完的事件(SELIN/SELOUT)，供边缘触发的selector使用
+	int8_t m_zc_state; //SO_ZEROCOPY，0未设置，1已开启，-1不支持
+	bool m_zc_head; //队首消息已有部分以零拷贝方式发送
+	bool m_zc_linger; //close()后已发送完，正在等待零拷贝完成通知
 	uint16_t m_send_queue_limit;
+	uint32_t m_zc_seq; //下一次零拷贝发送的序号，与内核的计数一致
+	bool m_dgram; //UDP socket，每个数据报是一个消息，不调用frame()
+	struct sockaddr_in m_peer_addr; //数据报连接上当前数据报的来源地址，accept的ipv4连接上为对端地址
 
 public:
 	NetConnect()
 		: m_send_list()
+		, m_zc_list()
 		, m_ctx(0)
+		, m_last_active_us(0)
 		, m_recv_buf(nullptr)
 		, m_recv_len(0)
 		, m_recv_buf_len(0)
+		, m_recv_pos(0)
+		, m_recv_hint(512)
+		, m_recv_pool(nullptr)
 		, m_header_len(0)
 		, m_body_len(0)
 		, m_fd(INVALID_SOCKET)
 		, m_timerid(-1)
+		, m_pipe_timerid(-1)
 		, m_client_thread_pool(INVALID_THREAD_POOL_ID)
 		, m_client_thread(INVALID_THREAD_ID)
+		, m_placement(ClientPlacement::ANY)
 		, m_state(NetConnectState::NET_CONN_CLOSED)
 		, m_net_msg_type(NetMsgType::CUSTOM_BIN)
+		, m_ready_events(0)
+		, m_zc_state(0)
+		, m_zc_head(false)
+		, m_zc_linger(false)
 		, m_send_queue_limit(64)
+		, m_zc_seq(0)
+		, m_dgram(false)
+		, m_peer_addr()
 	{
 	}
 	NetConnect(SOCKET_HANDLE fd,
 		NetConnectState state = NetConnectState::NET_CONN_CONNECTED)
 		: m_send_list()
+		, m_zc_list()
 		, m_ctx(0)
+		, m_last_active_us(0)
 		, m_recv_buf(nullptr)
 		, m_recv_len(0)
 		, m_recv_buf_len(0)
+		, m_recv_pos(0)
+		, m_recv_hint(512)
+		, m_recv_pool(nullptr)
 		, m_header_len(0)
 		, m_body_len(0)
 		, m_fd(fd)
 		, m_timerid(-1)
+		, m_pipe_timerid(-1)
 		, m_client_thread_pool(INVALID_THREAD_POOL_ID)
 		, m_client_thread(INVALID_THREAD_ID)
+		, m_placement(ClientPlacement::ANY)
 		, m_state(state)
 		, m_net_msg_type(NetMsgType::CUSTOM_BIN)
+		, m_ready_events(0)
+		, m_zc_state(0)
+		, m_zc_head(false)
+		, m_zc_linger(false)
 		, m_send_queue_limit(64)
+		, m_zc_seq(0)
+		, m_dgram(false)
+		, m_peer_addr()
 	{
 	}
 	NetConnect(SOCKET_HANDLE fd,
 		thread_pool_id_t client_thread_pool, thread_id_t client_thread)
 		: m_send_list()
+		, m_zc_list()
 		, m_ctx(0)
+		, m_last_active_us(0)
 		, m_recv_buf(nullptr)
 		, m_recv_len(0)
 		, m_recv_buf_len(0)
+		, m_recv_pos(0)
+		, m_recv_hint(512)
+		, m_recv_pool(nullptr)
 		, m_header_len(0)
 		, m_body_len(0)
 		, m_fd(fd)
 		, m_timerid(-1)
+		, m_pipe_timerid(-1)
 		, m_client_thread_pool(client_thread_pool)
 		, m_client_thread(client_thread)
+		, m_placement(ClientPlacement::ANY)
 		, m_state(NetConnectState::NET_CONN_LISTENING)
 		, m_net_msg_type(NetMsgType::CUSTOM_BIN)
+		, m_ready_events(0)
+		, m_zc_state(0)
+		, m_zc_head(false)
+		, m_zc_linger(false)
 		, m_send_queue_limit(64)
+		, m_zc_seq(0)
+		, m_dgram(false)
+		, m_peer_addr()
 	{
 	}
 	~NetConnect()
 	{
 		destruct();
-		if (m_recv_buf != nullptr) free(m_recv_buf);
+		release_recv_buffer();
 	}
 	void destruct()
 	{
-		m_recv_len = 0; //m_recv_buf继续使用
+		consume_recv(m_recv_len); //m_recv_buf继续使用
 		if (m_fd != INVALID_SOCKET)
 		{
 			_INFOLOG(logger, "close sockfd:%d, state:%d", (int)m_fd, (int)m_state);
@@ -433,10 +982,20 @@ public:
 		}
 		while (!m_send_list.empty())
 		{
-			auto& it = m_send_list.front();
+			m_send_list.front().release();
+			m_send_list.pop_front();
+		}
+		//连接已关闭，不再等待零拷贝完成通知
+		while (!m_zc_list.empty())
+		{
+			auto& it = m_zc_list.front();
 			free_buffer(it.data, it.buf_type);
-			m_send_list.pop();
+			m_zc_list.pop_front();
 		}
+		m_zc_state = 0;
+		m_zc_head = false;
+		m_zc_linger = false;
+		m_zc_seq = 0;
 	}
 	NetConnect(const NetConnect&) = delete;
 	NetConnect& operator=(const NetConnect&) = delete;
@@ -451,7 +1010,8 @@ public:
 	{
 		if (&val != this)
 		{
-			free(m_recv_buf);
+			m_recv_len = 0;
+			release_recv_buffer();
 			copy(std::move(val));
 		}
 		return *this;
@@ -461,19 +1021,33 @@ private:
 	void copy(NetConnect&& val)
 	{
 		m_send_list = std::move(val.m_send_list);
+		m_zc_list = std::move(val.m_zc_list);
 		m_ctx = val.m_ctx;
+		m_last_active_us = val.m_last_active_us;
 		m_recv_buf = val.m_recv_buf; val.m_recv_buf = nullptr;
 		m_recv_len = val.m_recv_len;
 		m_recv_buf_len = val.m_recv_buf_len;
+		m_recv_pos = val.m_recv_pos;
+		m_recv_hint = val.m_recv_hint;
+		m_recv_pool = val.m_recv_pool;
 		m_header_len = val.m_header_len;
 		m_body_len = val.m_body_len;
 		m_fd = val.m_fd; val.m_fd = INVALID_SOCKET; //do NOT close fd
 		m_timerid = val.m_timerid; val.m_timerid = -1;
+		m_pipe_timerid = val.m_pipe_timerid; val.m_pipe_timerid = -1;
 		m_client_thread_pool = val.m_client_thread_pool;
 		m_client_thread = val.m_client_thread;
+		m_placement = val.m_placement;
 		m_state = val.m_state;
 		m_net_msg_type = val.m_net_msg_type;
+		m_ready_events = val.m_ready_events;
+		m_zc_state = val.m_zc_state;
+		m_zc_head = val.m_zc_head;
+		m_zc_linger = val.m_zc_linger;
 		m_send_queue_limit = val.m_send_queue_limit;
+		m_zc_seq = val.m_zc_seq;
+		m_dgram = val.m_dgram;
+		m_peer_addr = val.m_peer_addr;
 	}
 
 public:
@@ -484,52 +1058,169 @@ public:
 	uint32_t send_queue_size(){return static_cast<uint32_t>(m_send_list.size());}
 	uint32_t send_queue_empty(){return m_send_list.empty();}
 	bool send_queue_full(){return m_send_list.size() >= m_send_queue_limit;}
+	//保证从当前帧开始至少有n字节的容量，必要时先将当前帧移到缓冲区开头
 	void enlarge_recv_buffer(int32_t n)
 	{
 		if (n > m_recv_buf_len)
 		{
-			m_recv_buf_len = n;
-			m_recv_buf = static_cast<char*>(realloc(m_recv_buf, n + 32));
-			assert(m_recv_buf != nullptr);
+			if (n <= m_recv_pos + m_recv_buf_len)
+			{
+				compact_recv_buffer();
+				return;
+			}
+			if (m_recv_pool != nullptr)
+			{ //从池中取更大的缓冲区，只复制未处理的数据
+				int32_t cap;
+				char* buf = m_recv_pool->alloc(n, cap);
+				if (m_recv_len > 0) memcpy(buf, m_recv_buf, m_recv_len);
+				if (m_recv_buf != nullptr) m_recv_pool->release(recv_buf_base(), m_recv_pos + m_recv_buf_len);
+				m_recv_buf = buf;
+				m_recv_buf_len = cap;
+				m_recv_pos = 0;
+			}
+			else
+			{
+				compact_recv_buffer();
+				m_recv_buf_len = n;
+				m_recv_buf = static_cast<char*>(realloc(m_recv_buf, n + 32));
+				assert(m_recv_buf != nullptr);
+			}
 #ifdef _ASYNCPP_DEBUG
 			//memory barrier
-			memcpy(m_recv_buf + n + 16, "ASYNCPPMEMORYBAR", 16);
+			memcpy(m_recv_buf + m_recv_buf_len + 16, "ASYNCPPMEMORYBAR", 16);
 #endif
 		}
 	}
 	void enlarge_recv_buffer()
 	{
-		enlarge_recv_buffer(m_recv_buf_len * 2 + 512);
+		int32_t cap = m_recv_pos + m_recv_buf_len;
+		enlarge_recv_buffer(cap != 0 ? cap * 2 : m_recv_hint);
 	}
-	void detach_recv_buffer()
+	/*
+	 数据已全部处理时，将接收缓冲区还给池，下次接收时再取
+	 @param peak 本次用到的最大长度，用于调整下次取的长度
+	*/
+	void release_recv_buffer(int32_t peak = 0)
+	{
+		if (m_recv_buf == nullptr || m_recv_len != 0) return;
+		int32_t cap = m_recv_pos + m_recv_buf_len;
+		if (m_recv_pool != nullptr)
+		{
+			m_recv_pool->release(recv_buf_base(), cap);
+			//用量不到1/4时减半，避免一次大包后一直取大缓冲区
+			if (peak * 4 <= cap) cap /= 2;
+			m_recv_hint = cap > _ASYNCPP_RECV_POOL_MAX_BUF ? _ASYNCPP_RECV_POOL_MAX_BUF
+				: cap < 512 ? 512 : cap;
+		}
+		else free(recv_buf_base());
+		m_recv_buf = nullptr;
+		m_recv_buf_len = 0;
+		m_recv_pos = 0;
+	}
+	/*
+	 取走接收缓冲区，调用者负责free
+	 @return 缓冲区起始地址，当前帧已移到开头
+	*/
+	char* detach_recv_buffer()
 	{
+		compact_recv_buffer();
+		char* buf = m_recv_buf;
+		if (buf != nullptr && m_recv_pool != nullptr) m_recv_pool->detach(m_recv_buf_len);
 		m_recv_buf = nullptr;
 		m_recv_len = 0;
+		m_recv_buf_len = 0;
+		return buf;
+	}
+	//当前帧的地址和已收到的长度，与m_recv_buf/m_recv_len相同
+	char* recv_data() { return m_recv_buf; }
+	int32_t recv_data_len() const { return m_recv_len; }
+	//接收缓冲区的起始地址，已处理的数据位于[recv_buf_base(), m_recv_buf)
+	char* recv_buf_base() { return m_recv_buf - m_recv_pos; }
+	/*
+	 处理完当前帧开头的n字节，m_recv_buf后移
+	 数据全部处理完时回到缓冲区开头
+	*/
+	void consume_recv(int32_t n)
+	{
+		assert(n <= m_recv_len);
+		if (n == m_recv_len)
+		{
+			m_recv_buf -= m_recv_pos;
+			m_recv_buf_len += m_recv_pos;
+			m_recv_pos = 0;
+			m_recv_len = 0;
+		}
+		else
+		{
+			m_recv_buf += n;
+			m_recv_buf_len -= n;
+			m_recv_pos += n;
+			m_recv_len -= n;
+		}
+	}
+	//将未处理的数据移到缓冲区开头
+	void compact_recv_buffer()
+	{
+		if (m_recv_pos == 0) return;
+		char* base = recv_buf_base();
+		memmove(base, m_recv_buf, m_recv_len);
+		m_recv_buf = base;
+		m_recv_buf_len += m_recv_pos;
+		m_recv_pos = 0;
 	}
 	uint32_t id(){ return static_cast<uint32_t>(m_fd); }
 	std::pair<std::string, uint16_t> get_addr() const
 	{
-		char ip[MAX_IP] = {};
-		struct sockaddr_in addr;
+		struct sockaddr_storage addr;
 		socklen_t len = sizeof addr;
 		int ret = getsockname(m_fd,
 			reinterpret_cast<struct sockaddr*>(&addr), &len);
 		if (ret != 0) return {std::string(), 0};
-		asyncpp_inet_ntop(addr.sin_family,
-			reinterpret_cast<void*>(&addr.sin_addr), ip, MAX_IP);
-		return {std::string(ip), be16toh(addr.sin_port)};
+		return addr_pair(addr, len);
 	}
+	//数据报连接上返回当前数据报的来源地址，accept时已保存地址的连接不再调用getpeername
 	std::pair<std::string, uint16_t> get_peer_addr() const
 	{
-		char ip[MAX_IP] = {};
-		struct sockaddr_in addr;
+		struct sockaddr_storage addr;
 		socklen_t len = sizeof addr;
+		if (m_dgram || m_peer_addr.sin_family == AF_INET)
+		{
+			memcpy(&addr, &m_peer_addr, sizeof m_peer_addr);
+			return addr_pair(addr, sizeof m_peer_addr);
+		}
 		int ret = getpeername(m_fd,
 			reinterpret_cast<struct sockaddr*>(&addr), &len);
 		if (ret != 0) return {std::string(), 0};
-		asyncpp_inet_ntop(addr.sin_family,
-			reinterpret_cast<void*>(&addr.sin_addr), ip, MAX_IP);
-		return {std::string(ip), be16toh(addr.sin_port)};
+		return addr_pair(addr, len);
+	}
+	/*
+	 ipv4地址返回<ip, port>
+	 Unix域socket返回<"unix:路径", 0>，抽象命名空间的路径以@开头，未绑定的一端为"unix:"
+	*/
+	static std::pair<std::string, uint16_t> addr_pair(
+		const struct sockaddr_storage& addr, socklen_t len)
+	{
+#ifndef _WIN32
+		if (addr.ss_family == AF_UNIX)
+		{
+			auto un = reinterpret_cast<const struct sockaddr_un*>(&addr);
+			size_t n = static_cast<size_t>(len) > offsetof(struct sockaddr_un, sun_path)
+				? len - offsetof(struct sockaddr_un, sun_path) : 0;
+			std::string path("unix:");
+			if (n > 0 && un->sun_path[0] == '\0')
+			{
+				path += '@';
+				path.append(un->sun_path + 1, n - 1);
+			}
+			else path.append(un->sun_path, strnlen(un->sun_path, n));
+			return {path, 0};
+		}
+#endif
+		char ip[MAX_IP] = {};
+		auto in = reinterpret_cast<const struct sockaddr_in*>(&addr);
+		asyncpp_inet_ntop(in->sin_family,
+			reinterpret_cast<const void*>(&in->sin_addr), ip, MAX_IP);
+		return {std::string(ip), be16toh(in->sin_port)};
 	}
 	int32_t setopt(int level, int optname, const char* optval, int optlen)
 	{
@@ -549,7 +1240,68 @@ public: //private
 	{
 		if (m_send_list.size() < m_send_queue_limit)
 		{
-			m_send_list.push({ msg, msg_len, 0, buf_type });
+			m_send_list.push_back({ msg, msg_len, 0, buf_type });
+			return 0;
+		}
+		else
+		{
+			_WARNLOG(logger, "conn %d send list full", (int)m_fd);
+			return EAGAIN;
+		}
+	}
+	//数据报发往peer，见SendMsgType::peer
+	int32_t send_to(uint64_t peer, char* msg, uint32_t msg_len,
+		MsgBufferType buf_type = MsgBufferType::STATIC)
+	{
+		if (m_send_list.size() < m_send_queue_limit)
+		{
+			SendMsgType item = { msg, msg_len, 0, buf_type };
+			item.peer = peer;
+			m_send_list.push_back(item);
+			return 0;
+		}
+		else
+		{
+			_WARNLOG(logger, "conn %d send list full", (int)m_fd);
+			return EAGAIN;
+		}
+	}
+	//队列放不下全部iovcnt段时不入队
+	int32_t send(const struct iovec* iov, int32_t iovcnt,
+		MsgBufferType buf_type = MsgBufferType::STATIC)
+	{
+		if (m_send_list.size() + iovcnt <= m_send_queue_limit)
+		{
+			for (int32_t i = 0; i < iovcnt; ++i)
+			{
+				m_send_list.push_back({ static_cast<char*>(iov[i].iov_base),
+					static_cast<uint32_t>(iov[i].iov_len), 0, buf_type });
+			}
+			return 0;
+		}
+		else
+		{
+			_WARNLOG(logger, "conn %d send list full", (int)m_fd);
+			return EAGAIN;
+		}
+	}
+	//文件按_ASYNCPP_SEND_FILE_CHUNK拆成多项，队列放不下全部项时不入队
+	int32_t send_file(int32_t fd, uint64_t offset, uint64_t length,
+		SendMsgSource source, bool close_fd)
+	{
+		uint64_t cnt = (length + _ASYNCPP_SEND_FILE_CHUNK - 1) / _ASYNCPP_SEND_FILE_CHUNK;
+		if (m_send_list.size() + cnt <= m_send_queue_limit)
+		{
+			while (length > 0)
+			{
+				uint32_t len = length < _ASYNCPP_SEND_FILE_CHUNK
+					? static_cast<uint32_t>(length) : _ASYNCPP_SEND_FILE_CHUNK;
+				length -= len;
+				//只有最后一项负责关闭fd
+				m_send_list.push_back({ nullptr, len, 0, MsgBufferType::STATIC,
+					source, close_fd && length == 0, fd, offset });
+				offset += len;
+			}
 			return 0;
 		}
 		else
@@ -571,8 +1323,8 @@ public: //private
 		{
 			auto& it = m_send_list.front();
 			bytes += it.data_len - it.bytes_sent;
-			free_buffer(it.data, it.buf_type);
-			m_send_list.pop();
+			it.release();
+			m_send_list.pop_front();
 		}
 		return bytes;
 #endif
@@ -611,6 +1363,7 @@ class AddConnectorCtx : public QueryDnsCtx
 {
 public:
 	uint32_t m_connid;
+	int32_t m_sock_type = SOCK_STREAM; //SOCK_DGRAM表示UDP
 
 	AddConnectorCtx() = default;
 	~AddConnectorCtx() = default;
@@ -619,6 +1372,16 @@ public:
 	AddConnectorCtx& operator=(const AddConnectorCtx&) = default;
 };
 
+/*
+ 线程组内每个线程各自监听同一端口(SO_REUSEPORT)时，连接在各监听socket间的分配方式
+*/
+enum class ReusePortMode : uint8_t
+{
+	NONE,	//只有一个监听socket
+	HASH,	//内核按四元组哈希选择监听socket
+	CPU,	//按收到连接的CPU选择，CPU k上的连接交给第k个线程(模线程数)，仅Linux
+};
+
 class AddListenerCtx : public MsgContext
 {
 public:
@@ -628,6 +1391,12 @@ public:
 	thread_pool_id_t m_client_thread_pool_id;
 	thread_id_t m_client_thread_id;
 	uint16_t m_port;
+	int32_t m_sock_type = SOCK_STREAM; //SOCK_DGRAM表示在本线程绑定UDP端口，忽略client线程
+	ReusePortMode m_reuseport = ReusePortMode::NONE; //见AsyncFrame::add_reuseport_listener
+	int32_t m_backlog = _ASYNCPP_LISTEN_BACKLOG;
+	uint32_t m_defer_accept = 0; //TCP_DEFER_ACCEPT(s)，0表示不设置
+	ClientPlacement m_placement = ClientPlacement::ANY; //m_client_thread_id为INVALID_THREAD_ID时有效
+	std::vector<SOCKET_HANDLE> m_reuseport_fds; //reuseport组内已建立的监听fd，下标为线程id
 
 	AddListenerCtx() = default;
 	virtual ~AddListenerCtx() = default;
@@ -652,7 +1421,8 @@ enum ReservedThreadMsgType
 	NET_LISTEN_ADDR_RESP,	//msg.m_buf = ip
 							//msg.m_ctx.obj = AddListenerCtx*
 	
-	NET_ACCEPT_CLIENT_REQ,  //msg.m_ctx.i64 = fd
+	NET_ACCEPT_CLIENT_REQ,  //msg.m_buf = AcceptedClient[]
+							//msg.m_ctx.i64 = client number
 	NET_ACCEPT_CLIENT_RESP,	//response ONLY on ERROR, msg.m_ctx.i64 = ret<<32 | fd
 	
 	NET_QUERY_DNS_REQ,      //msg.m_buf = host
@@ -668,6 +1438,16 @@ enum ReservedThreadMsgType
 
 const uint32_t SPEEDUNLIMITED = 3 * 1024 * 1024 * 1024u; //3GB/s
 
+/*
+ 低延迟模式下网络线程的耗时统计(us)
+*/
+struct BusyPollStat
+{
+	uint64_t m_spin_us; //空转轮询，没有处理任何消息
+	uint64_t m_work_us; //处理线程消息和网络事件
+	uint64_t m_park_us; //超出空转预算后挂起
+};
+
 /************** Net Recv & Send Thread ****************/
 class NetBaseThread : public BaseThread
 {
@@ -678,6 +1458,21 @@ public:
 	volatile uint32_t m_idle_timeout; //s
 	volatile uint32_t m_sendspeedlimit; //B/s
 	volatile uint32_t m_recvspeedlimit; //B/s
+	bool m_lazy_idle_timeout;
+	volatile uint32_t m_busy_poll_us; //空转预算，0表示不空转
+	uint32_t m_sock_busy_poll_us; //SO_BUSY_POLL，0表示不设置
+	bool m_prefer_busy_poll; //SO_PREFER_BUSY_POLL
+	std::atomic<uint64_t> m_spin_us;
+	std::atomic<uint64_t> m_work_us;
+	std::atomic<uint64_t> m_park_us;
+	volatile uint32_t m_zerocopy_threshold; //B，0表示不使用零拷贝发送
+	RecvBufferPool m_recv_pool; //本线程连接的接收缓冲区
+	//供listener按ClientPlacement选择线程，由本线程定期更新
+	std::atomic<uint32_t> m_load_conns; //连接数，listener分配连接后先加1
+	std::atomic<uint64_t> m_load_bytes; //更新时的时间(s)<<32 | 上一秒收发的字节数
+private:
+	uint32_t m_next_client_thread; //ClientPlacement::ROUND_ROBIN
+	std::vector<std::pair<char*, uint32_t>> m_accept_batches; //do_accept中发往各线程的客户端
 public:
 	NetBaseThread()
 		: m_ss()
@@ -686,6 +1481,19 @@ public:
 		, m_idle_timeout(_ASYNCPP_IDLE_TIMEOUT)
 		, m_sendspeedlimit(SPEEDUNLIMITED)
 		, m_recvspeedlimit(SPEEDUNLIMITED)
+		, m_lazy_idle_timeout(false)
+		, m_busy_poll_us(0)
+		, m_sock_busy_poll_us(0)
+		, m_prefer_busy_poll(false)
+		, m_spin_us(0)
+		, m_work_us(0)
+		, m_park_us(0)
+		, m_zerocopy_threshold(0)
+		, m_recv_pool()
+		, m_load_conns(0)
+		, m_load_bytes(0)
+		, m_next_client_thread(0)
+		, m_accept_batches()
 	{
 	}
 	~NetBaseThread() = default;
@@ -708,18 +1516,85 @@ public:
 	void set_connect_timeout(uint32_t t){m_connect_timeout=t;}
 	//连接上t秒收不到数据后产生错误ETIMEDOUT
 	void set_idle_timeout(uint32_t t){m_idle_timeout=t;}
+	/*
+	 延迟检查空闲超时
+	 开启后收发数据时只记录活跃时间，不再修改定时器；
+	 定时器触发时若连接期间有过活动，则按剩余时间重新添加定时器，否则产生ETIMEDOUT
+	*/
+	void set_lazy_idle_timeout(bool enable){m_lazy_idle_timeout=enable;}
+	/*
+	 低延迟模式：没有消息和网络事件时以0超时反复轮询selector，不挂起线程
+	 @param spin_us 连续空转超过该时长(us)后挂起，0关闭低延迟模式，UINT32_MAX表示从不挂起
+	 @param sock_busy_poll_us >0时对之后加入的连接设置SO_BUSY_POLL(us)，仅Linux
+	 @param prefer_busy_poll 同时设置SO_PREFER_BUSY_POLL
+	*/
+	void set_busy_poll(uint32_t spin_us, uint32_t sock_busy_poll_us = 0,
+		bool prefer_busy_poll = false)
+	{
+		m_busy_poll_us = spin_us;
+		m_sock_busy_poll_us = sock_busy_poll_us;
+		m_prefer_busy_poll = prefer_busy_poll;
+	}
+	uint32_t busy_poll() const { return m_busy_poll_us; }
+	/*
+	 长度不小于threshold的消息以MSG_ZEROCOPY发送，0关闭，仅Linux 4.14+的TCP连接
+	 这些消息发送完后不会立刻释放，而是在内核通知页面已释放后调用on_zerocopy_done()
+	 零拷贝有固定开销(页面锁定和完成通知)，一般只适合几十KB以上的消息
+	*/
+	void set_zerocopy(uint32_t threshold){m_zerocopy_threshold=threshold;}
+	uint32_t zerocopy() const { return m_zerocopy_threshold; }
+	/*
+	 接收缓冲区池最多缓存的字节数，只能在本线程内调用
+	 连接的数据处理完后缓冲区即还给池，空闲连接不占用接收缓冲区
+	*/
+	void set_recv_pool_limit(size_t bytes){m_recv_pool.set_limit(bytes);}
+	size_t get_recv_pool_limit() const {return m_recv_pool.get_limit();}
+	//接收缓冲区池的占用情况，可在其他线程读取
+	RecvPoolStat get_recv_pool_stat() const {return m_recv_pool.get_stat();}
+	/*
+	 低延迟模式下的耗时统计，可在其他线程读取，用于评估需要独占的核数
+	*/
+	BusyPollStat get_busy_poll_stat() const
+	{
+		return BusyPollStat{m_spin_us.load(std::memory_order_relaxed),
+			m_work_us.load(std::memory_order_relaxed),
+			m_park_us.load(std::memory_order_relaxed)};
+	}
 public:
 	virtual void run() override;
 public:
 	/*一般情况下，请勿调用这些函数*/
+	/*
+	 连接上有数据收发时调用，推迟空闲超时
+	*/
+	void touch_idle_timer(NetConnect* conn)
+	{
+		if (m_lazy_idle_timeout) conn->m_last_active_us = m_now_us;
+		else change_timer(conn->m_timerid, m_idle_timeout);
+	}
 	uint32_t on_read_event(NetConnect* conn);
 	uint32_t on_write_event(NetConnect* conn);
-	void on_error_event(NetConnect* conn)
+	/*
+	 @param errcode 收发失败时的错误码，0表示selector报告的错误事件，从SO_ERROR读取
+	*/
+	void on_error_event(NetConnect* conn, int32_t errcode = 0)
 	{
-		int32_t ret = GET_SOCK_ERR();
-		int32_t sockerr = 0;
-		socklen_t len = sizeof(sockerr);
-		getsockopt(conn->m_fd, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&sockerr), &len);
+		int32_t ret = errcode != 0 ? errcode : GET_SOCK_ERR();
+		int32_t sockerr = errcode;
+		if (sockerr == 0)
+		{
+			socklen_t len = sizeof(sockerr);
+			if (getsockopt(conn->m_fd, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&sockerr), &len) != 0)
+			{ //如poll报告POLLNVAL
+				sockerr = GET_SOCK_ERR();
+			}
+		}
+		if (sockerr == 0 && conn->m_zc_state > 0)
+		{ //错误队列中只是零拷贝完成通知，可能已在do_send中读完
+			if (conn->m_zc_linger) close_after_zerocopy(conn);
+			else reap_zerocopy(conn);
+			return;
+		}
 		
 		_WARNLOG(logger, "sockfd:%d, sockerr:%d, errno:%d[%s], state:%d", (int)conn->m_fd, sockerr, ret, strerror(errno), (int)conn->m_state);
 		if (conn->m_state == NetConnectState::NET_CONN_CLOSING)
@@ -737,30 +1612,117 @@ public:
 protected:
 	/*一般情况下，请勿调用这些函数*/
 	uint32_t do_accept(NetConnect* conn);
+	/*
+	 accept一个客户端，ipv4连接同时保存对端地址
+	 @return 失败时返回INVALID_SOCKET，错误码由GET_SOCK_ERR()取得
+	*/
+	virtual SOCKET_HANDLE accept_client(NetConnect* listener, AcceptedClient& client);
+	/*
+	 以一个NET_ACCEPT_CLIENT_REQ将cnt个客户端转交给指定线程，接管clients(new char[])
+	 发送失败时关闭这些客户端
+	*/
+	bool send_accepted_clients(thread_pool_id_t thread_pool, thread_id_t thread,
+		char* clients, uint32_t cnt);
+	/*
+	 按listener的m_client_thread和m_placement为客户端选择处理线程
+	 @return INVALID_THREAD_ID表示交给线程组中先取到消息的线程
+	*/
+	thread_id_t select_client_thread(NetConnect* listener, const AcceptedClient& client);
+	//更新m_load_conns/m_load_bytes
+	void update_load(uint32_t conn_num)
+	{
+		m_ss.sample(0, 0); //没有收发时也转到当前秒
+		const auto& s = m_ss.get_speed();
+		uint64_t bytes = static_cast<uint64_t>(s.first) + s.second;
+		if (bytes > UINT32_MAX) bytes = UINT32_MAX;
+		m_load_conns.store(conn_num, std::memory_order_relaxed);
+		m_load_bytes.store(static_cast<uint64_t>(static_cast<uint32_t>(g_unix_timestamp)) << 32
+			| bytes, std::memory_order_relaxed);
+	}
 	uint32_t do_connect(NetConnect* conn);
 	uint32_t do_send(NetConnect* conn);
 	uint32_t do_recv(NetConnect* conn);
+	//数据报连接的收发，每次系统调用最多处理_ASYNCPP_UDP_BATCH个数据报
+	uint32_t do_recv_dgram(NetConnect* conn);
+	uint32_t do_send_dgram(NetConnect* conn);
+	/*
+	 读取错误队列中的零拷贝完成通知，对已完成的消息调用on_zerocopy_done()
+	 @return 读到的通知数
+	*/
+	uint32_t reap_zerocopy(NetConnect* conn);
+	/*
+	 close()的连接发送完后调用，零拷贝发送的消息都已完成时关闭连接
+	 否则只关注可读事件并等待完成通知，最长_ASYNCPP_ZEROCOPY_LINGER秒
+	*/
+	void close_after_zerocopy(NetConnect* conn);
+	/*
+	 放弃等待零拷贝完成通知，以RST关闭连接
+	 正常关闭时内核会继续发送队列中引用这些消息页面的数据，释放后被复用的内存会被发出
+	*/
+	void abort_zerocopy(NetConnect* conn);
+	void cancel_pipe_retry(NetConnect* conn)
+	{
+		if (conn->m_pipe_timerid >= 0)
+		{
+			del_timer(conn->m_pipe_timerid);
+			conn->m_pipe_timerid = -1;
+		}
+	}
+	//是否以MSG_ZEROCOPY发送该消息，必要时开启SO_ZEROCOPY
+	bool use_zerocopy(NetConnect* conn, const SendMsgType& msg);
 	int32_t set_sock_nonblock(SOCKET_HANDLE fd);
 	int32_t set_sock_cloexec(SOCKET_HANDLE fd);
-	SOCKET_HANDLE create_tcp_socket(bool nonblock = true);
+	//按set_busy_poll()的参数设置SO_BUSY_POLL/SO_PREFER_BUSY_POLL
+	int32_t set_sock_busy_poll(SOCKET_HANDLE fd);
+	//family为AF_UNIX时创建Unix域的流socket
+	SOCKET_HANDLE create_tcp_socket(bool nonblock = true, int family = AF_INET);
 
 protected:
 	/*
 	 创建一个监听
+	 ip为"unix:/path"时监听Unix域socket，启动时删除残留的socket文件；"unix:@name"为抽象命名空间
+	 defer_accept不为0时设置TCP_DEFER_ACCEPT(s)，仅Linux的ipv4监听
 	 @return <result, fd>, on success result=0
 	*/
 	virtual std::pair<int32_t, SOCKET_HANDLE>
 		create_listen_socket(const char* ip, uint16_t port,
 			thread_pool_id_t client_thread_pool, thread_id_t client_thread,
-			bool nonblock = true);
+			bool nonblock = true, int32_t backlog = _ASYNCPP_LISTEN_BACKLOG,
+			uint32_t defer_accept = 0);
+
+	/*
+	 create_listen_socket的实现，reuseport不为NONE时设置SO_REUSEPORT，
+	 group为同一端口上的监听socket数，用于ReusePortMode::CPU
+	*/
+	std::pair<int32_t, SOCKET_HANDLE>
+		open_listen_socket(const char* ip, uint16_t port,
+			thread_pool_id_t client_thread_pool, thread_id_t client_thread,
+			bool nonblock, ReusePortMode reuseport, uint32_t group,
+			int32_t backlog, uint32_t defer_accept);
 
 	/*
-	 创建一个连接
+	 处理ReusePortMode不为NONE的NET_LISTEN_ADDR_REQ
+	 在本线程监听并直接处理accept的连接，然后将请求转给组内下一个线程，
+	 最后一个线程或出错的线程回复NET_LISTEN_ADDR_RESP
+	*/
+	void listen_reuseport(ThreadMsg& msg);
+
+	/*
+	 创建一个连接，ip可以是Unix域socket地址，格式同create_listen_socket
 	 @return <result, fd>, on success result=0
 	*/
 	virtual std::pair<int32_t, SOCKET_HANDLE>
 		create_connect_socket(const char* ip, uint16_t port,
 		bool nonblock = true, uint32_t seq = 0);
+
+	/*
+	 创建一个UDP socket，is_bind为true时绑定ip:port，否则connect到ip:port
+	 收到的每个数据报回调一次process_net_msg，conn->m_peer_addr为来源地址
+	 @return <result, fd>, on success result=0
+	*/
+	std::pair<int32_t, SOCKET_HANDLE>
+		create_udp_socket(const char* ip, uint16_t port,
+		bool is_bind, uint32_t seq = 0);
 protected:
 	/*
 	 线程内部接口，获取一个消息的长度
@@ -770,6 +1732,16 @@ protected:
 	*/
 	virtual int32_t frame(NetConnect* conn);
 
+	/*
+	 本线程accept的连接指定由本线程处理时调用，不经过消息队列
+	*/
+	virtual void add_accepted_conn(const AcceptedClient& client)
+	{
+		NetConnect conn(client.fd);
+		conn.m_peer_addr = client.addr;
+		add_conn(&conn);
+	}
+
 	/*
 	 accept一个客户端后回调
 	 @return 0 pass
@@ -795,6 +1767,17 @@ protected:
 	*/
 	virtual int32_t on_error(NetConnect* conn, int32_t errcode){return 0;}
 
+	/*
+	 以MSG_ZEROCOPY发送的消息，内核释放页面后回调，可在此回收缓冲区
+	 默认按buf_type释放；close()的连接等到消息都确认后才关闭(最长_ASYNCPP_ZEROCOPY_LINGER秒)，
+	 超时或对端关闭时先复位连接再释放尚未确认的消息，出错或强制关闭时直接释放，都不会回调
+	*/
+	virtual void on_zerocopy_done(NetConnect* conn, char* data, uint32_t data_len,
+		MsgBufferType buf_type)
+	{
+		free_buffer(data, buf_type);
+	}
+
 public:
 	/*
 	 关闭连接
@@ -858,6 +1841,42 @@ public:
 		}
 	}
 
+	/*
+	 发送由多段组成的数据，各段按顺序排队，不需要先拼接
+	 每段的缓冲区都按buf_type释放；队列放不下全部段时返回EAGAIN，不接管任何一段
+	 @return result
+	*/
+	int32_t send(NetConnect* conn, const struct iovec* iov, int32_t iovcnt,
+		MsgBufferType buf_type = MsgBufferType::STATIC)
+	{
+		if (conn->m_state == NetConnectState::NET_CONN_CONNECTED
+			|| conn->m_state == NetConnectState::NET_CONN_CONNECTING)
+		{
+			_DEBUGLOG(logger, "conn %d send %d parts", (int)conn->m_fd, iovcnt);
+			if (conn->m_send_list.empty())
+			{
+				set_rdwr_event(conn);
+			}
+			return conn->send(iov, iovcnt, buf_type);
+		}
+		else
+		{
+			_WARNLOG(logger, "conn %d error state:%d", (int)conn->m_fd, (int)conn->m_state);
+			assert(0);
+			return EBUSY;
+		}
+	}
+
+	/*
+	 发送文件fd中从offset开始的length字节，与其他消息按入队顺序发送，同样受发送限速约束
+	 普通文件使用sendfile，不需要读入内存；管道使用splice，忽略offset，length不能为0
+	 length为0表示发送到文件末尾
+	 close_fd为true时，发送完毕或连接关闭后关闭fd；入队失败时不关闭
+	 @return result，不支持时返回ENOTSUP
+	*/
+	int32_t send_file(NetConnect* conn, int32_t fd, uint64_t offset, uint64_t length,
+		bool close_fd = false);
+
 	/*
 	 发送数据
 	 这些数据将会被排队发送，如果队列满，返回EAGAIN
@@ -878,6 +1897,22 @@ public:
 			return EINVAL;
 		}
 	}
+
+	/*
+	 在数据报连接上向addr发送一个数据报，常用于回复conn->m_peer_addr
+	 数据报连接上的send()每条消息(每段)也是一个数据报，发往connect的对端
+	 @return result
+	*/
+	int32_t send_to(NetConnect* conn, const struct sockaddr_in& addr,
+		char* msg, uint32_t msg_len, MsgBufferType buf_type = MsgBufferType::STATIC);
+
+	/*
+	 向多个连接发送同一份数据，各连接共享buf，不复制
+	 buf须由alloc_shared_buffer分配，调用者持有的一个引用由本函数接管
+	 不存在、已关闭或发送队列满的连接被跳过
+	 @return 成功入队的连接数
+	*/
+	uint32_t broadcast(const std::vector<uint32_t>& conn_ids, char* buf, uint32_t len);
 	
 	/*
 	 立刻向特定连接发送数据
@@ -932,6 +1967,28 @@ public:
 			{
 				conn->m_timerid = -1;
 
+				if (conn->m_zc_linger)
+				{
+					_WARNLOG(logger, "sockfd:%d zerocopy linger timeout, %u msgs not confirmed",
+						(int)conn->m_fd, conn->m_zc_list.size());
+					abort_zerocopy(conn);
+					break;
+				}
+
+				if (m_lazy_idle_timeout
+					&& conn->m_state == NetConnectState::NET_CONN_CONNECTED)
+				{
+					uint64_t deadline = conn->m_last_active_us + m_idle_timeout * 1000000ull;
+					if (deadline > m_now_us)
+					{ //期间有过活动，按剩余时间重新计时
+						uint64_t remain = deadline - m_now_us;
+						conn->m_timerid = add_timer_us(remain < UINT32_MAX
+							? static_cast<uint32_t>(remain) : UINT32_MAX,
+							NetTimeoutTimer, ctx);
+						break;
+					}
+				}
+
 				if (conn->m_state != NetConnectState::NET_CONN_CLOSING
 					&& conn->m_state != NetConnectState::NET_CONN_CLOSED
 					&& on_error(conn, ETIMEDOUT) == 0)
@@ -944,6 +2001,18 @@ public:
 		case NetBusyTimer:
 			///TODO: process_net_msg返回busy表示业务繁忙，框架会暂停收包，稍后回调
 			break;
+		case NetPipeRetryTimer:
+		{
+			NetConnect* conn = get_conn((uint32_t)ctx);
+			assert(conn != nullptr && conn->m_pipe_timerid == static_cast<int32_t>(timerid));
+			if (conn != nullptr && conn->m_pipe_timerid == static_cast<int32_t>(timerid))
+			{
+				conn->m_pipe_timerid = -1;
+				conn->m_ready_events |= SELOUT;
+				set_rdwr_event(conn);
+			}
+		}
+			break;
 		default:
 			_WARNLOG(logger, "recv error timer type:%d, timerid:%u, ctx:%" PRIu64, type, timerid, ctx);
 			break;
@@ -960,6 +2029,8 @@ public:
 };
 
 int32_t is_str_ipv4(const char* ipv4str);
+//是否为Unix域socket地址"unix:/path"或"unix:@name"
+int32_t is_str_unix(const char* addr);
 
 class NonblockNetThread : public NetBaseThread
 {
@@ -984,6 +2055,7 @@ public:
 	virtual void process_net_msg(NetConnect* conn) override{}
 	virtual int32_t poll() override
 	{
+		uint32_t bytes = 0;
 		if (m_conn.m_fd != INVALID_SOCKET)
 		{
 			uint32_t bytes_recv = 0;
@@ -1007,11 +2079,22 @@ public:
 #endif
 				m_conn.destruct();
 			}
+			bytes = bytes_sent + bytes_recv;
+		}
+		//作为客户端线程组时，供select_client_thread按负载选择
+		update_load(m_conn.m_fd != INVALID_SOCKET ? 1 : 0);
+		return bytes;
+	}
 
-			return bytes_sent + bytes_recv;
-
+	virtual void park(int64_t timeout_us) override
+	{
+		//连接上的事件需要主动轮询，有连接时最多等待50ms
+		if (m_conn.m_fd != INVALID_SOCKET
+			&& (timeout_us < 0 || timeout_us > 50 * 1000))
+		{
+			timeout_us = 50 * 1000;
 		}
-		else return 0;
+		NetBaseThread::park(timeout_us);
 	}
 
 	virtual void add_conn(NetConnect* conn) override
@@ -1019,14 +2102,18 @@ public:
 		assert(conn->m_fd != INVALID_SOCKET);
 		assert(m_conn.m_fd == INVALID_SOCKET);
 		assert(conn->m_fd != m_conn.m_fd);
-		if (conn->m_state == NetConnectState::NET_CONN_CONNECTED)
+		if (conn->m_state == NetConnectState::NET_CONN_CONNECTED
+			&& !conn->m_dgram) //数据报无连接，不检查空闲超时
 		{
 			conn->m_timerid = add_timer(m_idle_timeout, NetTimeoutTimer, conn->id());
+			conn->m_last_active_us = m_now_us;
 		}
 		else if (conn->m_state == NetConnectState::NET_CONN_CONNECTING)
 		{
 			conn->m_timerid = add_timer(m_connect_timeout, NetTimeoutTimer, conn->id());
 		}
+		set_sock_busy_poll(conn->m_fd);
+		if (conn->m_recv_buf == nullptr) conn->m_recv_pool = &m_recv_pool;
 		_DEBUGLOG(logger, "sockfd:%d, state:%d", (int)conn->m_fd, (int)conn->m_state);
 		m_conn = std::move(*conn);
 	}
@@ -1051,6 +2138,7 @@ public:
 				del_timer(conn->m_timerid);
 				conn->m_timerid = -1;
 			}
+			cancel_pipe_retry(conn);
 			on_close(conn);
 		}
 	}
@@ -1059,7 +2147,8 @@ protected:
 	virtual std::pair<int32_t, SOCKET_HANDLE>
 		create_listen_socket(const char* ip, uint16_t port,
 		thread_pool_id_t client_thread_pool, thread_id_t client_thread,
-		bool nonblock = true) override
+		bool nonblock = true, int32_t backlog = _ASYNCPP_LISTEN_BACKLOG,
+		uint32_t defer_accept = 0) override
 	{
 		return {EINVAL, INVALID_SOCKET};
 	}
@@ -1114,12 +2203,13 @@ protected:
 	virtual std::pair<int32_t, SOCKET_HANDLE>
 		create_listen_socket(const char* ip, uint16_t port,
 		thread_pool_id_t client_thread_pool, thread_id_t client_thread,
-		bool nonblock = true) override
+		bool nonblock = true, int32_t backlog = _ASYNCPP_LISTEN_BACKLOG,
+		uint32_t defer_accept = 0) override
 	{
 		if (m_conn.m_fd != INVALID_SOCKET)
 			return {EINPROGRESS,INVALID_SOCKET};
 		return NetBaseThread::create_listen_socket(ip, port,
-			client_thread_pool, client_thread, nonblock);
+			client_thread_pool, client_thread, nonblock, backlog, defer_accept);
 	}
 };
 
@@ -1129,13 +2219,21 @@ class MultiplexNetThread : public NetBaseThread
 private:
 	std::unordered_map<uint32_t, NetConnect> m_conns;
 	std::vector<uint32_t> m_removed_conns;
+	std::vector<AcceptedClient> m_accepted_clients; //分发事件期间accept的连接，分发完后加入
 	Selector m_selector;
 public:
 	MultiplexNetThread()
 		: m_conns()
 		, m_removed_conns()
+		, m_accepted_clients()
 		, m_selector()
 	{
+		//将唤醒用的eventfd注册进selector，空闲时直接阻塞在selector上
+		if (m_notifier.enable_fd() == 0
+			&& m_selector.set_notify_fd(m_notifier.fd()) != 0)
+		{
+			m_notifier.disable_fd();
+		}
 	}
 	~MultiplexNetThread()
 	{
@@ -1163,15 +2261,22 @@ public:
 		{
 		case NET_ACCEPT_CLIENT_REQ:
 		{
-			NetConnect conn(static_cast<SOCKET_HANDLE>(msg.m_ctx.i64));
-			add_conn(&conn);
+			auto clients = reinterpret_cast<const AcceptedClient*>(msg.m_buf);
+			for (uint64_t i = 0; i < msg.m_ctx.i64; ++i)
+			{
+				NetConnect conn(clients[i].fd);
+				conn.m_peer_addr = clients[i].addr;
+				add_conn(&conn);
+			}
 		}
 			break;
 		case NET_CONNECT_HOST_REQ:
-			if (is_str_ipv4(msg.m_buf))
+			if (is_str_ipv4(msg.m_buf) || is_str_unix(msg.m_buf))
 			{
 				auto ctx = (AddConnectorCtx*)msg.m_ctx.obj;
-				const auto& r = create_connect_socket(msg.m_buf, ctx->m_port, true, ctx->m_seq);
+				const auto& r = ctx->m_sock_type == SOCK_DGRAM
+					? create_udp_socket(msg.m_buf, ctx->m_port, false, ctx->m_seq)
+					: create_connect_socket(msg.m_buf, ctx->m_port, true, ctx->m_seq);
 
 				_DEBUGLOG(logger, "create_conn result:%d, fd:%d", (int)r.first, (int)r.second);
 
@@ -1228,10 +2333,22 @@ public:
 		case NET_LISTEN_ADDR_REQ:
 		{
 			auto ctx = (AddListenerCtx*)msg.m_ctx.obj;
-			const auto& r = create_listen_socket(msg.m_buf, ctx->m_port,
-				ctx->m_client_thread_pool_id, ctx->m_client_thread_id);
+			if (ctx->m_reuseport != ReusePortMode::NONE)
+			{
+				listen_reuseport(msg);
+				break;
+			}
+			const auto& r = ctx->m_sock_type == SOCK_DGRAM
+				? create_udp_socket(msg.m_buf, ctx->m_port, true, ctx->m_seq)
+				: create_listen_socket(msg.m_buf, ctx->m_port,
+					ctx->m_client_thread_pool_id, ctx->m_client_thread_id,
+					true, ctx->m_backlog, ctx->m_defer_accept);
 			ctx->m_ret = r.first;
 			ctx->m_connid = static_cast<uint32_t>(r.second);
+			if (r.first == 0 && ctx->m_sock_type != SOCK_DGRAM)
+			{
+				get_conn(ctx->m_connid)->m_placement = ctx->m_placement;
+			}
 
 			_DEBUGLOG(logger, "create_conn result:%d, fd:%d", (int)r.first, (int)r.second);
 
@@ -1245,7 +2362,9 @@ public:
 			auto ctx = (AddConnectorCtx*)msg.m_ctx.obj;
 			if (ctx->m_ret == 0)
 			{
-				const auto& r = create_connect_socket(ctx->m_ip, ctx->m_port, true, ctx->m_seq);
+				const auto& r = ctx->m_sock_type == SOCK_DGRAM
+					? create_udp_socket(ctx->m_ip, ctx->m_port, false, ctx->m_seq)
+					: create_connect_socket(ctx->m_ip, ctx->m_port, true, ctx->m_seq);
 
 				_DEBUGLOG(logger, "create_conn result:%d, fd:%d", (int)r.first, (int)r.second);
 
@@ -1265,6 +2384,31 @@ public:
 	}
 
 	virtual int32_t poll() override
+	{
+		return poll(0);
+	}
+
+	virtual void park(int64_t timeout_us) override
+	{
+		const auto& s = m_ss.get_cur_speed();
+		if (m_notifier.fd() >= 0
+			&& s.first < m_recvspeedlimit && s.second < m_sendspeedlimit)
+		{
+			poll(timeout_us < 0 ? UINT32_MAX
+				: static_cast<uint32_t>((timeout_us + 999) / 1000));
+			m_notifier.cancel_park();
+		}
+		else
+		{ //selector不支持唤醒或已限速，最多等待50ms
+			if (timeout_us < 0 || timeout_us > 50 * 1000) timeout_us = 50 * 1000;
+			NetBaseThread::park(timeout_us);
+		}
+	}
+
+	/*
+	 @param ms 等待网络事件的最长时间，UINT32_MAX表示一直等待
+	*/
+	int32_t poll(uint32_t ms)
 	{
 		uint32_t mode = 0;
 		const auto& s = m_ss.get_cur_speed();
@@ -1280,7 +2424,7 @@ public:
 		int32_t n = 0;
 		if (mode)
 		{
-			n = m_selector.poll(reinterpret_cast<void*>(this), mode, 0);
+			n = m_selector.poll(reinterpret_cast<void*>(this), mode, ms);
 		}
 		else
 		{
@@ -1306,6 +2450,16 @@ public:
 			m_removed_conns.clear();
 		}
 
+		if (!m_accepted_clients.empty())
+		{
+			for (const auto& client : m_accepted_clients)
+			{
+				NetBaseThread::add_accepted_conn(client);
+			}
+			m_accepted_clients.clear();
+		}
+		update_load(static_cast<uint32_t>(m_conns.size()));
+
 		return n;
 	}
 public:
@@ -1342,17 +2496,23 @@ public:
 			it = m_conns.insert(std::make_pair(static_cast<uint32_t>(fd), std::move(*conn))).first;
 		}
 
+#ifndef _ASYNCPP_ACCEPT4
 		set_sock_nonblock(fd);
+#endif //否则创建和accept得到的socket都已是非阻塞的
+		set_sock_busy_poll(fd);
 		conn = &it->second;
-		if (conn->m_state == NetConnectState::NET_CONN_CONNECTED)
+		if (conn->m_recv_buf == nullptr) conn->m_recv_pool = &m_recv_pool;
+		if (conn->m_state == NetConnectState::NET_CONN_CONNECTED
+			&& !conn->m_dgram) //数据报无连接，不检查空闲超时
 		{
 			conn->m_timerid = add_timer(m_idle_timeout, NetTimeoutTimer, fd);
+			conn->m_last_active_us = m_now_us;
 		}
 		else if (conn->m_state == NetConnectState::NET_CONN_CONNECTING)
 		{
 			conn->m_timerid = add_timer(m_connect_timeout, NetTimeoutTimer, fd);
 		}
-		int32_t ret = m_selector.add(fd, conn->m_state);
+		int32_t ret = m_selector.add(fd, conn->m_state, conn);
 		if (ret == 0)
 		{
 			_DEBUGLOG(logger, "sockfd:%d, state:%d", (int)fd, (int)conn->m_state);
@@ -1363,6 +2523,16 @@ public:
 			_ERRORLOG(logger, "sockfd:%d, state:%d, add selector ret:%d", (int)fd, (int)conn->m_state, ret);
 		}
 	}
+	//selector分发事件期间不能修改其中的fd集合，推迟到poll完成后加入
+	virtual void add_accepted_conn(const AcceptedClient& client) override
+	{
+		m_accepted_clients.push_back(client);
+	}
+	//UringSelector特化为取multishot accept已得到的连接
+	virtual SOCKET_HANDLE accept_client(NetConnect* listener, AcceptedClient& client) override
+	{
+		return NetBaseThread::accept_client(listener, client);
+	}
 	virtual void remove_conn(NetConnect* conn) override
 	{
 		assert(conn->m_fd != INVALID_SOCKET);
@@ -1375,6 +2545,7 @@ public:
 				del_timer(conn->m_timerid);
 				conn->m_timerid = -1;
 			}
+			cancel_pipe_retry(conn);
 			m_selector.del(conn->m_fd);
 			m_removed_conns.push_back(conn->id());
 			on_close(conn);
@@ -1407,6 +2578,11 @@ public:
 	}
 };
 
+#ifndef _DISABLE_IO_URING
+template<>
+SOCKET_HANDLE MultiplexNetThread<UringSelector>::accept_client(NetConnect* listener, AcceptedClient& client);
+#endif
+
 /************** Thread Poll ****************/
 class AsyncFrame;
 class ThreadPool
@@ -1415,13 +2591,17 @@ private:
 	FixedSizeCircleQueue<ThreadMsg, _ASYNCPP_THREAD_POOL_QUEUE_SIZE> m_msg_queue;
 	std::vector<BaseThread*> m_threads;
 	AsyncFrame* m_master;
+	std::atomic<uint32_t> m_next_thread;
 	thread_pool_id_t m_id;
+	bool m_work_stealing;
 public:
 	ThreadPool(AsyncFrame* asynframe, thread_pool_id_t id)
 		: m_msg_queue()
 		, m_threads()
 		, m_master(asynframe)
+		, m_next_thread(0)
 		, m_id(id)
+		, m_work_stealing(false)
 	{
 	}
 	~ThreadPool(){ for (auto t : m_threads) delete t; }
@@ -1449,7 +2629,7 @@ public:
 			{
 				if (!force_receiver_thread)
 				{
-					return m_msg_queue.push(std::move(msg));
+					return push_pool_msg(std::move(msg));
 				}
 				else return false;
 			}
@@ -1458,10 +2638,124 @@ public:
 		{
 			assert(!force_receiver_thread);
 			return !force_receiver_thread ?
-				m_msg_queue.push(std::move(msg)) : false;
+				push_pool_msg(std::move(msg)) : false;
+		}
+	}
+	bool push_pool_msg(ThreadMsg&& msg)
+	{
+		if (m_work_stealing && push_work_msg(std::move(msg)))
+		{
+			return true;
+		}
+		if (m_msg_queue.push(std::move(msg)))
+		{
+			wakeup_one();
+			return true;
+		}
+		else return false;
+	}
+
+	/*
+	 工作窃取模式下投递线程组消息
+	 组内线程发送的消息放入自己的本地队列，其它线程发送的消息放入负载最低线程的收件箱
+	 本地队列和收件箱都满时返回false，由调用者退回共享队列
+	*/
+	bool push_work_msg(ThreadMsg&& msg)
+	{
+		BaseThread* cur = BaseThread::current();
+		if (cur != nullptr && cur->get_thread_pool() == this
+			&& cur->push_local_msg(std::move(msg)))
+		{
+			wakeup_one(); //让空闲的兄弟线程来窃取
+			return true;
+		}
+		BaseThread* t = get_least_loaded_thread();
+		return t != nullptr && t->push_inbox_msg(std::move(msg));
+	}
+
+	/*
+	 选择本地负载最低的线程，优先选择已挂起的空闲线程
+	 从轮转位置开始扫描，避免负载相同时总是选中同一线程
+	*/
+	BaseThread* get_least_loaded_thread()
+	{
+		uint32_t n = static_cast<uint32_t>(m_threads.size());
+		if (n == 0) return nullptr;
+		uint32_t start = m_next_thread.fetch_add(1, std::memory_order_relaxed) % n;
+		BaseThread* best = nullptr;
+		uint32_t best_load = UINT32_MAX;
+		for (uint32_t i = 0; i < n; ++i)
+		{
+			BaseThread* t = m_threads[(start + i) % n];
+			uint32_t load = t->get_local_load();
+			if (load == 0 && t->parked()) return t;
+			if (load < best_load)
+			{
+				best = t;
+				best_load = load;
+			}
+		}
+		return best;
+	}
+
+	/*
+	 thief空闲时调用，从其后的兄弟线程开始依次尝试批量窃取
+	*/
+	uint32_t steal_msg(const BaseThread* thief, ThreadMsg* msg, uint32_t n)
+	{
+		uint32_t cnt = static_cast<uint32_t>(m_threads.size());
+		for (uint32_t i = 1; i < cnt; ++i)
+		{
+			BaseThread* victim = m_threads[(thief->get_id() + i) % cnt];
+			uint32_t stolen = victim->steal_msg(msg, n);
+			if (stolen != 0) return stolen;
+		}
+		return 0;
+	}
+
+	/*
+	 组内是否有可被窃取的消息
+	*/
+	bool has_stealable_msg() const
+	{
+		for (auto t : m_threads)
+		{
+			if (t->has_stealable_msg()) return true;
+		}
+		return false;
+	}
+
+	/*
+	 开启工作窃取模式，只能在线程组启动前调用
+	 开启后发往INVALID_THREAD_ID的消息不再经过共享队列(除非本地队列都已满)，
+	 空闲线程从兄弟线程的本地队列中批量窃取消息
+	 全局线程组(id=0)不支持此模式
+	*/
+	void set_work_stealing(bool enable)
+	{
+		if (m_id == 0) return;
+		m_work_stealing = enable;
+		for (auto t : m_threads) t->enable_work_stealing(enable);
+	}
+	bool work_stealing() const { return m_work_stealing; }
+	/*
+	 唤醒线程组中的一个挂起线程
+	*/
+	void wakeup_one()
+	{
+		for (auto t : m_threads)
+		{
+			if (t->parked() && t->wakeup()) return;
 		}
 	}
+	void wakeup_all()
+	{
+		for (auto t : m_threads) t->wakeup();
+	}
 	uint32_t pop(ThreadMsg* msg, uint32_t n){return m_msg_queue.pop(msg, n);}
+	bool empty() { return m_msg_queue.empty_safe(); }
+	//不加锁读取，结果可能过时，仅用于跳过空队列的加锁
+	bool empty_hint() const { return m_msg_queue.empty(); }
 	bool full() const { return m_msg_queue.full(); }
 	bool full(thread_id_t thread_id) const
 	{
@@ -1469,13 +2763,28 @@ public:
 	}
 	uint32_t get_queued_msg_number() const
 	{
-		return m_msg_queue.size();
+		uint32_t n = m_msg_queue.size();
+		if (m_work_stealing)
+		{
+			for (auto t : m_threads) n += t->get_local_load();
+		}
+		return n;
 	}
 	uint32_t get_queued_msg_number(thread_id_t thread_id) const
 	{
 		return m_threads[thread_id]->get_queued_msg_number();
 	}
 
+	/*
+	 设置线程组消息队列容量，overflow为true时队列满后的消息存入溢出段
+	 只能在线程组启动前调用，队列中已有的消息会被丢弃
+	*/
+	void set_msg_queue_size(uint32_t size, bool overflow = false)
+	{
+		m_msg_queue.resize(size, overflow);
+	}
+	uint32_t get_msg_queue_capacity() const { return m_msg_queue.capacity(); }
+
 	/*遍历消息队列,返回删除的消息个数
 	int32_t callback(ThreadMsg& v, void*);
 	return 0 -> ignore
@@ -1497,6 +2806,7 @@ public:
 	{
 		new_thread->set_id(static_cast<thread_id_t>(m_threads.size()));
 		new_thread->set_thread_pool(this);
+		if (m_work_stealing) new_thread->enable_work_stealing(true);
 		m_threads.push_back(new_thread);
 		return new_thread->get_id();
 	}
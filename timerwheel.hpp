@@ -0,0 +1,348 @@
+﻿#ifndef _TIMERWHEEL_HPP_
+#define _TIMERWHEEL_HPP_
+
+#include "asyncommon.hpp"
+#include "clock.hpp"
+#include <vector>
+#include <cstdint>
+#include <cassert>
+#ifdef _WIN32
+#include <intrin.h>
+#endif
+
+#ifndef _ASYNCPP_TIMER_WHEEL_TICK_US
+#define _ASYNCPP_TIMER_WHEEL_TICK_US 1000 //每格时长
+#endif
+
+namespace asyncpp
+{
+
+/*
+ 分层哈希时间轮，定时器的增删改均为O(1)
+ 第0层256格，第1-4层各64格，按_ASYNCPP_TIMER_WHEEL_TICK_US=1ms计可覆盖约49天，
+ 更远的定时器放入最高层，逐层下沉(cascade)时重新计算位置
+ 定时器到期时间向上取整到格，不会提前触发
+ 接口与pqueue<TimerMsg>保持一致：push返回的下标即timerid，修改m_expire_time后调用change_priority
+ 到期的定时器由advance()移入就绪链表，再通过pop_expired()逐个取出
+*/
+class TimerWheel
+{
+private:
+	enum : uint32_t
+	{
+		LV0_BITS = 8,
+		LVN_BITS = 6,
+		LEVELS = 5,
+		LV0_SIZE = 1u << LV0_BITS,
+		LVN_SIZE = 1u << LVN_BITS,
+		SLOT_NUM = LV0_SIZE + (LEVELS - 1) * LVN_SIZE,
+		EXPIRED_LIST = SLOT_NUM, //就绪链表
+		LIST_NUM = SLOT_NUM + 1,
+	};
+	static const int32_t NIL = -1;
+
+	struct Node
+	{
+		TimerMsg msg;
+		int32_t prev;
+		int32_t next;
+		int32_t list; //所在链表，<0表示空闲
+		uint64_t tick; //到期格
+	};
+
+	std::vector<Node> m_nodes;
+	std::vector<int32_t> m_free_list;
+	int32_t m_head[LIST_NUM];
+	int32_t m_tail[LIST_NUM];
+	uint64_t m_bitmap[SLOT_NUM / 64]; //各格是否非空
+	uint64_t m_cur_tick; //已处理到的格
+	uint32_t m_size; //全部定时器，包括就绪链表中的
+	uint32_t m_wheel_size; //仍在轮上的定时器
+
+	static uint32_t level_shift(uint32_t level)
+	{
+		return level == 0 ? 0 : LV0_BITS + (level - 1) * LVN_BITS;
+	}
+	static uint32_t level_size(uint32_t level)
+	{
+		return level == 0 ? LV0_SIZE : LVN_SIZE;
+	}
+	static uint32_t level_base(uint32_t level)
+	{
+		return level == 0 ? 0 : LV0_SIZE + (level - 1) * LVN_SIZE;
+	}
+	static uint32_t ctz64(uint64_t bits)
+	{
+#ifdef _WIN32
+		unsigned long pos;
+		_BitScanForward64(&pos, bits);
+		return static_cast<uint32_t>(pos);
+#else
+		return static_cast<uint32_t>(__builtin_ctzll(bits));
+#endif
+	}
+	static uint64_t us_to_tick(uint64_t us)
+	{
+		return (us + _ASYNCPP_TIMER_WHEEL_TICK_US - 1) / _ASYNCPP_TIMER_WHEEL_TICK_US;
+	}
+
+	void link(int32_t idx, int32_t list)
+	{
+		Node& n = m_nodes[idx];
+		n.list = list;
+		n.next = NIL;
+		n.prev = m_tail[list];
+		if (m_tail[list] != NIL) m_nodes[m_tail[list]].next = idx;
+		else m_head[list] = idx;
+		m_tail[list] = idx;
+		if (list != EXPIRED_LIST)
+		{
+			m_bitmap[list >> 6] |= 1ull << (list & 63);
+			++m_wheel_size;
+		}
+	}
+	void unlink(int32_t idx)
+	{
+		Node& n = m_nodes[idx];
+		int32_t list = n.list;
+		if (n.prev != NIL) m_nodes[n.prev].next = n.next;
+		else m_head[list] = n.next;
+		if (n.next != NIL) m_nodes[n.next].prev = n.prev;
+		else m_tail[list] = n.prev;
+		if (list != EXPIRED_LIST)
+		{
+			if (m_head[list] == NIL) m_bitmap[list >> 6] &= ~(1ull << (list & 63));
+			--m_wheel_size;
+		}
+		n.list = NIL;
+	}
+	//按到期格放入对应层的格中，已到期的直接放入就绪链表
+	void place(int32_t idx)
+	{
+		uint64_t tick = m_nodes[idx].tick;
+		if (tick <= m_cur_tick)
+		{
+			link(idx, EXPIRED_LIST);
+			return;
+		}
+		uint64_t delta = tick - m_cur_tick;
+		uint32_t level = 0;
+		//第level层可容纳delta < 2^level_shift(level+1)
+		while (level < LEVELS - 1 && delta >= (1ull << level_shift(level + 1)))
+		{
+			++level;
+		}
+		if (level == LEVELS - 1)
+		{ //超出覆盖范围的放入最高层最远的格
+			uint64_t max_delta = (1ull << level_shift(LEVELS)) - 1;
+			if (delta > max_delta) tick = m_cur_tick + max_delta;
+		}
+		uint32_t slot = static_cast<uint32_t>(tick >> level_shift(level)) & (level_size(level) - 1);
+		link(idx, static_cast<int32_t>(level_base(level) + slot));
+	}
+	//将level层当前格中的定时器重新放置到低层
+	void cascade(uint32_t level)
+	{
+		uint32_t slot = static_cast<uint32_t>(m_cur_tick >> level_shift(level)) & (LVN_SIZE - 1);
+		int32_t list = static_cast<int32_t>(level_base(level) + slot);
+		int32_t idx = m_head[list];
+		while (idx != NIL)
+		{
+			int32_t next = m_nodes[idx].next;
+			unlink(idx);
+			place(idx);
+			idx = next;
+		}
+		if (slot == 0 && level < LEVELS - 1) cascade(level + 1);
+	}
+	void expire_slot(uint32_t slot)
+	{
+		int32_t idx;
+		while ((idx = m_head[slot]) != NIL)
+		{
+			unlink(idx);
+			link(idx, EXPIRED_LIST);
+		}
+	}
+	/*
+	 在level层[from, level_size)范围内查找非空格
+	 @return 格下标，-1表示没有
+	*/
+	int32_t find_slot(uint32_t level, uint32_t from) const
+	{
+		uint32_t base = level_base(level);
+		uint32_t end = base + level_size(level);
+		for (uint32_t pos = base + from; pos < end; )
+		{
+			uint64_t bits = m_bitmap[pos >> 6] >> (pos & 63);
+			if (bits != 0)
+			{
+				pos += ctz64(bits);
+				return pos < end ? static_cast<int32_t>(pos - base) : -1;
+			}
+			pos = (pos | 63) + 1;
+		}
+		return -1;
+	}
+
+public:
+	explicit TimerWheel(uint64_t now_us = monotonic_us())
+		: m_nodes()
+		, m_free_list()
+		, m_bitmap()
+		, m_cur_tick(now_us / _ASYNCPP_TIMER_WHEEL_TICK_US)
+		, m_size(0)
+		, m_wheel_size(0)
+	{
+		for (uint32_t i = 0; i < LIST_NUM; ++i) m_head[i] = m_tail[i] = NIL;
+	}
+	~TimerWheel() = default;
+	TimerWheel(const TimerWheel&) = delete;
+	TimerWheel& operator=(const TimerWheel&) = delete;
+
+	bool empty() const { return m_size == 0; }
+	uint32_t size() const { return m_size; }
+
+	void reserve(int32_t n)
+	{
+		m_nodes.reserve(n);
+		m_free_list.reserve(n);
+	}
+
+	bool is_index_valid(int32_t data_index) const
+	{
+		return static_cast<uint32_t>(data_index) < m_nodes.size()
+			&& m_nodes[data_index].list >= 0;
+	}
+
+	/*
+	 轮上没有定时器时，直接将当前格对齐到now_us，避免advance()逐格追赶
+	*/
+	void sync(uint64_t now_us)
+	{
+		uint64_t now_tick = now_us / _ASYNCPP_TIMER_WHEEL_TICK_US;
+		if (m_wheel_size == 0 && now_tick > m_cur_tick) m_cur_tick = now_tick;
+	}
+
+	int32_t push(TimerMsg&& val)
+	{
+		int32_t idx;
+		if (!m_free_list.empty())
+		{
+			idx = m_free_list.back();
+			m_free_list.pop_back();
+		}
+		else
+		{
+			idx = static_cast<int32_t>(m_nodes.size());
+			m_nodes.push_back(Node());
+		}
+		Node& n = m_nodes[idx];
+		n.msg = std::move(val);
+		n.tick = us_to_tick(n.msg.m_expire_time);
+		place(idx);
+		++m_size;
+		return idx;
+	}
+
+	void remove(int32_t data_index)
+	{
+		unlink(data_index);
+		m_free_list.push_back(data_index);
+		--m_size;
+	}
+
+	/*
+	 m_expire_time被修改后调用
+	*/
+	void change_priority(int32_t data_index)
+	{
+		unlink(data_index);
+		m_nodes[data_index].tick = us_to_tick(m_nodes[data_index].msg.m_expire_time);
+		place(data_index);
+	}
+
+	const TimerMsg& operator[](int32_t data_index) const { return m_nodes[data_index].msg; }
+	TimerMsg& operator[](int32_t data_index) { return m_nodes[data_index].msg; }
+
+	/*
+	 转动时间轮到now_us，到期的定时器移入就绪链表
+	 连续的空格会被整段跳过
+	*/
+	void advance(uint64_t now_us)
+	{
+		uint64_t now_tick = now_us / _ASYNCPP_TIMER_WHEEL_TICK_US;
+		while (m_cur_tick < now_tick)
+		{
+			if (m_wheel_size == 0)
+			{
+				m_cur_tick = now_tick;
+				break;
+			}
+			uint32_t from = static_cast<uint32_t>(m_cur_tick + 1) & (LV0_SIZE - 1);
+			if (from != 0 && find_slot(0, from) < 0)
+			{ //第0层本轮已无定时器，跳到下一轮起点
+				uint64_t boundary = (m_cur_tick | (LV0_SIZE - 1)) + 1;
+				if (boundary > now_tick)
+				{
+					m_cur_tick = now_tick;
+					break;
+				}
+				m_cur_tick = boundary - 1;
+				continue;
+			}
+			++m_cur_tick;
+			uint32_t slot = static_cast<uint32_t>(m_cur_tick) & (LV0_SIZE - 1);
+			if (slot == 0) cascade(1);
+			expire_slot(slot);
+		}
+	}
+
+	/*
+	 取出一个就绪的定时器
+	 @return timerid, -1表示没有
+	*/
+	int32_t pop_expired(TimerMsg& msg)
+	{
+		int32_t idx = m_head[EXPIRED_LIST];
+		if (idx == NIL) return -1;
+		msg = m_nodes[idx].msg;
+		remove(idx);
+		return idx;
+	}
+
+	/*
+	 下一次需要处理时间轮的时刻(us)，可能早于实际到期时间(高层格下沉时)
+	 @return UINT64_MAX表示没有定时器
+	*/
+	uint64_t next_expire_time() const
+	{
+		if (m_head[EXPIRED_LIST] != NIL) return 0;
+		if (m_wheel_size == 0) return UINT64_MAX;
+		uint64_t next = UINT64_MAX;
+		for (uint32_t level = 0; level < LEVELS; ++level)
+		{
+			uint32_t shift = level_shift(level);
+			uint32_t lsize = level_size(level);
+			uint64_t block = m_cur_tick >> shift;
+			uint32_t pos = static_cast<uint32_t>(block) & (lsize - 1);
+			uint64_t tick;
+			int32_t slot = find_slot(level, pos + 1);
+			if (slot >= 0)
+			{
+				tick = (block - pos + slot) << shift;
+			}
+			else if ((slot = find_slot(level, 0)) >= 0)
+			{ //下一轮
+				tick = (block - pos + lsize + slot) << shift;
+			}
+			else continue;
+			if (tick < next) next = tick;
+		}
+		return next * _ASYNCPP_TIMER_WHEEL_TICK_US;
+	}
+};
+
+} //end of namespace asyncpp
+
+#endif